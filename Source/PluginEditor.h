@@ -106,6 +106,8 @@ public:
     {
         String s;
         s << "Active voices: " << processor.getNumActiveVoices();
+        if (const auto numUnderruns = processor.getNumUnderruns())
+            s << " (underruns: " << static_cast<int>(numUnderruns) << ")";
         numVoices.setText(s, dontSendNotification);
     }
 
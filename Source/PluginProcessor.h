@@ -89,6 +89,7 @@ public:
     int getNumGroups() const { return sfzSynth.getNumGroups(); }
     int getNumMasters() const { return sfzSynth.getNumMasters(); }
     inline int getNumActiveVoices() { return sfzSynth.getNumActiveVoices(); }
+    uint32_t getNumUnderruns() const noexcept { return sfzSynth.getNumUnderruns(); }
     StringArray getUnknownOpcodes() const { return sfzSynth.getUnknownOpcodes(); }
     StringArray getCCLabels() const { return sfzSynth.getCCLabels(); }
     
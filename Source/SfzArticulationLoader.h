@@ -0,0 +1,238 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include "SfzLockFreeQueue.h"
+#include "SfzRegion.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <vector>
+
+enum class SfzArticulationLoading
+{
+    eager, // Preload everything when loading the instrument
+    background, // Preload the default articulation, then the others in the background
+    onSelection // Preload the default articulation, and the others when they are first selected
+};
+
+/**
+ * Preloads the articulations of a keyswitched instrument lazily. The regions
+ * switched by sw_last form one articulation per keyswitch; only the one given
+ * by sw_default is preloaded with the instrument, the others are preloaded by
+ * a background thread, in the order they appear or as soon as they are
+ * selected. With a release timeout, the articulations that were not selected
+ * for that long are unloaded again until their next selection; the default
+ * articulation and the regions without a keyswitch always stay.
+ *
+ * The voices get no data for an articulation that is not loaded yet and stay
+ * silent, so the first notes after selecting an articulation may be lost.
+ */
+class SfzArticulationLoader: public Thread
+{
+public:
+    /**
+     * Group the regions by articulation and preload the default one; the
+     * regions must be prepared with their preload deferred, and stay in place
+     * until the loader is destroyed.
+     */
+    SfzArticulationLoader(std::vector<SfzRegion>& regions, SfzFilePool& filePool, std::optional<uint8_t> defaultSwitch,
+                          SfzArticulationLoading mode, double releaseTimeoutInSeconds = 0.0)
+    : Thread("SfzArticulationLoader"),
+      filePool(filePool),
+      mode(mode),
+      releaseTimeout(static_cast<uint32>(jmax(releaseTimeoutInSeconds, 0.0) * 1000.0)),
+      selections(config::articulationSelectionQueueSize)
+    {
+        articulationForNote.fill(noArticulation);
+        for (auto& region: regions)
+        {
+            if (region.isGenerator())
+                continue;
+
+            if (!region.keyswitch || (defaultSwitch && *region.keyswitch == *defaultSwitch) || mode == SfzArticulationLoading::eager)
+            {
+                if (region.keyswitch)
+                    articulationForNote[*region.keyswitch] = permanentArticulation;
+                permanentSamples.insert(region.preloadSample());
+                continue;
+            }
+
+            auto& index = articulationForNote[*region.keyswitch];
+            if (index == noArticulation)
+            {
+                index = static_cast<int>(articulations.size());
+                articulations.push_back(std::make_unique<Articulation>());
+                articulations.back()->keyswitch = *region.keyswitch;
+            }
+            articulations[index]->regions.push_back(&region);
+        }
+
+        if (!articulations.empty())
+            startThread(config::articulationLoaderPriority);
+    }
+
+    ~SfzArticulationLoader()
+    {
+        stopThread(config::ioThreadStopTimeout);
+    }
+
+    /**
+     * Tell the loader that a note was played; keyswitches select their
+     * articulation. This is safe to call from the audio thread.
+     */
+    void registerNoteOn(int noteNumber) noexcept
+    {
+        if (noteNumber < 0 || noteNumber > 127 || articulationForNote[noteNumber] == noArticulation)
+            return;
+
+        const auto index = articulationForNote[noteNumber];
+        currentArticulation = index;
+        if (index == permanentArticulation)
+            return;
+
+        articulations[index]->lastSelected = Time::getMillisecondCounter();
+        // If the queue is full the loader is busy anyway and will get to it
+        selections.push(index);
+    }
+
+    int getNumArticulations() const noexcept { return static_cast<int>(articulations.size()); }
+    int getNumLoadedArticulations() const noexcept
+    {
+        return static_cast<int>(std::count_if(articulations.begin(), articulations.end(), [](const auto& articulation) {
+            return articulation->state == State::loaded;
+        }));
+    }
+
+    // Whether the regions selected by a keyswitch have their data
+    bool isLoaded(uint8_t keyswitch) const noexcept
+    {
+        const auto index = articulationForNote[keyswitch];
+        return index == permanentArticulation || (index >= 0 && articulations[index]->state == State::loaded);
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            int selected;
+            while (selections.pop(selected) && !threadShouldExit())
+            {
+                if (articulations[selected]->state != State::loaded)
+                    load(*articulations[selected]);
+            }
+
+            if (mode == SfzArticulationLoading::background)
+            {
+                // One articulation at a time so that the selections are served in between
+                auto next = std::find_if(articulations.begin(), articulations.end(), [](const auto& articulation) {
+                    return articulation->state == State::unloaded;
+                });
+                if (next != articulations.end())
+                {
+                    load(**next);
+                    continue;
+                }
+            }
+
+            releaseUnusedArticulations();
+            wait(config::articulationLoaderPeriod);
+        }
+    }
+private:
+    enum class State { unloaded, loaded, released };
+    // Markers for the notes that do not select a lazily loaded articulation
+    static constexpr int noArticulation { -1 };
+    static constexpr int permanentArticulation { -2 };
+
+    struct Articulation
+    {
+        uint8_t keyswitch { 0 };
+        std::vector<SfzRegion*> regions;
+        std::vector<SfzSampleId> samples;
+        std::atomic<State> state { State::unloaded };
+        std::atomic<uint32> lastSelected { 0 };
+    };
+
+    void load(Articulation& articulation)
+    {
+        articulation.samples.clear();
+        for (auto* region: articulation.regions)
+        {
+            if (threadShouldExit())
+                return;
+            articulation.samples.push_back(region->preloadSample());
+        }
+        // Loading counts as a use, otherwise a long load could be released right away
+        articulation.lastSelected = Time::getMillisecondCounter();
+        articulation.state = State::loaded;
+    }
+
+    void releaseUnusedArticulations()
+    {
+        if (releaseTimeout == 0)
+            return;
+
+        const auto now = Time::getMillisecondCounter();
+        for (int index = 0; index < static_cast<int>(articulations.size()); ++index)
+        {
+            auto& articulation = *articulations[index];
+            if (articulation.state != State::loaded || index == currentArticulation)
+                continue;
+
+            if (now - articulation.lastSelected < releaseTimeout)
+                continue;
+
+            // Samples can be shared with the permanent regions or with other articulations
+            articulation.state = State::released;
+            for (auto sampleId: articulation.samples)
+            {
+                if (sampleId == invalidSampleId || permanentSamples.count(sampleId) > 0 || isUsedByLoadedArticulation(sampleId))
+                    continue;
+                filePool.unload(sampleId);
+            }
+        }
+    }
+
+    bool isUsedByLoadedArticulation(SfzSampleId sampleId) const
+    {
+        return std::any_of(articulations.begin(), articulations.end(), [sampleId](const auto& articulation) {
+            return articulation->state == State::loaded
+                && std::find(articulation->samples.begin(), articulation->samples.end(), sampleId) != articulation->samples.end();
+        });
+    }
+
+    SfzFilePool& filePool;
+    const SfzArticulationLoading mode;
+    const uint32 releaseTimeout; // milliseconds, 0 for never
+    std::vector<std::unique_ptr<Articulation>> articulations;
+    std::array<int, 128> articulationForNote;
+    std::set<SfzSampleId> permanentSamples;
+    std::atomic<int> currentArticulation { noArticulation };
+    SfzLockFreeQueue<int> selections;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzArticulationLoader)
+};
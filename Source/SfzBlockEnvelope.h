@@ -17,8 +17,8 @@ public:
 
     void reserve(int maximum)
     {
-        events.reserve(maximumEvents);
         maximumEvents = maximum;
+        events.reserve(maximumEvents);
     }
 
     void addEvent(int timestamp, InputType value)
@@ -80,9 +80,11 @@ public:
             currentValue += step;
         }
 
-        // Backtrack if we get here because it means we went 1 step too far out
-        currentValue -= step;
-        clearEvents();
+        // The events past the end of the block are kept for the next one, which
+        // carries on with the ramp from here
+        events.erase(events.begin(), events.begin() + eventIndex);
+        for (auto& event: events)
+            event.timestamp -= static_cast<int>(numSamples);
     }
     void clearEvents()
     {
@@ -0,0 +1,102 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include "SfzLockFreeQueue.h"
+#include <memory>
+#include <vector>
+
+/**
+ * A slab of fixed-size audio chunks used to stream the sample files.
+ * All the sample memory is a single allocation made in allocate(); the
+ * chunks are views over it. Borrowing and returning a chunk is lock-free
+ * and never allocates, so it can be done from the audio thread and the
+ * streaming memory use stays the same whatever the note rate.
+ */
+class SfzChunkPool
+{
+public:
+    SfzChunkPool() = default;
+
+    /**
+     * (Re)allocate the slab. None of the chunks must be borrowed at this point.
+     */
+    void allocate(int numChunks, int newChunkSize)
+    {
+        jassert(numChunks > 0 && newChunkSize > 0);
+        jassert(chunks.empty() || static_cast<int>(freeChunks->getNumReady()) == getNumChunks());
+
+        chunkSize = newChunkSize;
+        const auto frameSize = static_cast<size_t>(config::numChannels) * chunkSize;
+        slab.calloc(frameSize * numChunks);
+
+        chunks.clear();
+        chunks.reserve(numChunks);
+        freeChunks = std::make_unique<SfzLockFreeQueue<AudioBuffer<float>*>>(numChunks);
+        for (int chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+        {
+            float* channels[config::numChannels];
+            for (int chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+                channels[chanIdx] = slab.get() + frameSize * chunkIdx + static_cast<size_t>(chunkSize) * chanIdx;
+
+            chunks.push_back(std::make_unique<AudioBuffer<float>>(channels, config::numChannels, chunkSize));
+            freeChunks->push(chunks.back().get());
+        }
+    }
+
+    /**
+     * Borrow a chunk; returns nullptr if they are all in use.
+     */
+    AudioBuffer<float>* acquire() noexcept
+    {
+        AudioBuffer<float>* chunk { nullptr };
+        if (freeChunks != nullptr)
+            freeChunks->pop(chunk);
+        return chunk;
+    }
+
+    /**
+     * Give a borrowed chunk back; the pointer is null after the call.
+     */
+    void release(AudioBuffer<float>*& chunk) noexcept
+    {
+        if (chunk == nullptr)
+            return;
+
+        // The queue holds every chunk so this cannot fail, unless a chunk is returned twice
+        const auto returned = freeChunks->push(chunk);
+        jassert(returned);
+        ignoreUnused(returned);
+        chunk = nullptr;
+    }
+
+    int getChunkSize() const noexcept { return chunkSize; }
+    int getNumChunks() const noexcept { return static_cast<int>(chunks.size()); }
+    int getNumFreeChunks() const noexcept { return freeChunks != nullptr ? static_cast<int>(freeChunks->getNumReady()) : 0; }
+private:
+    int chunkSize { 0 };
+    HeapBlock<float> slab;
+    std::vector<std::unique_ptr<AudioBuffer<float>>> chunks;
+    std::unique_ptr<SfzLockFreeQueue<AudioBuffer<float>*>> freeChunks;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzChunkPool)
+};
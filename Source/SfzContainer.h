@@ -19,48 +19,99 @@
     ==============================================================================
 */
 
+
 #pragma once
 #include "../JuceLibraryCode/JuceHeader.h"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
-template<class ValueType>
+/**
+ * Values indexed by a small integer key, typically a CC number, with a
+ * default value for the keys that were never set.
+ *
+ * The keys that are set are marked in a presence bitmask and their values
+ * kept in a compact vector sorted by key; the position of a key in the vector
+ * is the number of keys set below it. Lookups are a bit test and a popcount,
+ * and iterating goes over the keys that are set only. Setting a new key is
+ * linear in the number of keys set, which only happens when loading.
+ *
+ * The references returned by operator[] stay valid until the next key is set.
+ */
+template<class ValueType, int NumKeys = 128>
 class SfzContainer
 {
 public:
+    static_assert(NumKeys > 0 && NumKeys <= 64 * 4, "The presence mask holds up to 256 keys");
+
     SfzContainer(const ValueType& defaultValue)
     : defaultValue(defaultValue) { }
 
     const ValueType &getWithDefault(int index) const noexcept
     {
-        auto it = container.find(index);
-        if (it == end(container))
-        {
+        if (!contains(index))
             return defaultValue;
-        }
-        else
-        {
-            return it->second;
-        }
+
+        return values[rank(index)].second;
     }
 
     bool contains(int index) const noexcept
     {
-        return container.find(index) != end(container);
+        if (index < 0 || index >= NumKeys)
+            return false;
+
+        return (presence[index / 64] >> (index % 64)) & 1;
     }
 
     const ValueType &at(int index) const
     {
-        return container.at(index);
+        if (!contains(index))
+            throw std::out_of_range("SfzContainer::at");
+
+        return values[rank(index)].second;
     }
 
     ValueType &operator[](const int &key) noexcept
     {
-        if (!contains(key))
-            container.emplace(key, defaultValue);
-        return container.operator[](key);
+        if (key < 0 || key >= NumKeys)
+        {
+            jassertfalse;
+            outOfRange = defaultValue;
+            return outOfRange;
+        }
+
+        const auto position = values.begin() + rank(key);
+        if (contains(key))
+            return position->second;
+
+        presence[key / 64] |= uint64_t(1) << (key % 64);
+        return values.emplace(position, key, defaultValue)->second;
     }
 
-    inline bool empty() const { return container.empty(); }
+    inline bool empty() const { return values.empty(); }
+    inline size_t size() const { return values.size(); }
+
+    // Iterate over the (key, value) pairs that are set, by increasing key
+    auto begin() const noexcept { return values.cbegin(); }
+    auto end() const noexcept { return values.cend(); }
 private:
+    // The number of keys set below the index
+    size_t rank(int index) const noexcept
+    {
+        size_t count { 0 };
+        const auto word = index / 64;
+        for (int i = 0; i < word; ++i)
+            count += std::bitset<64>(presence[i]).count();
+
+        const auto bitsBelow = (uint64_t(1) << (index % 64)) - 1;
+        return count + std::bitset<64>(presence[word] & bitsBelow).count();
+    }
+
     const ValueType defaultValue;
-    std::map<int, ValueType> container;
-};
\ No newline at end of file
+    std::array<uint64_t, (NumKeys + 63) / 64> presence {};
+    std::vector<std::pair<int, ValueType>> values;
+    ValueType outOfRange { defaultValue };
+};
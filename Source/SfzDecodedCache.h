@@ -0,0 +1,275 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+/**
+ * A directory of compressed samples (flac, ogg) decoded once to 32 bits
+ * float wav files, so that loading and streaming them later is a plain read
+ * or a memory mapping instead of a decoding pass.
+ *
+ * The entries are named after the MD5 of the compressed file and the decoding
+ * parameters, so a sample that changes on disk gets a new entry and the stale
+ * one ages out. When the directory grows past its size limit the least
+ * recently used entries are deleted, except the ones in use by this cache and
+ * the ones used recently, which other instances may be playing. An entry that
+ * disappears anyway is not fatal: the samples are then read from the
+ * compressed files.
+ *
+ * Hashing a large sample takes about as long as reading it, so the hashes are
+ * kept in an index in the directory, keyed by the path of the compressed file
+ * and checked against its size and modification time. Several instances
+ * can share the directory: the files are written aside under unique names and
+ * moved in place once complete.
+ */
+class SfzDecodedCache
+{
+public:
+    SfzDecodedCache(const File& directory, int64 maxSizeInBytes = config::decodedCacheSize,
+                    RelativeTime protection = RelativeTime::hours(config::decodedCacheProtectionHours))
+    : directory(directory), maxSize(maxSizeInBytes), protection(protection)
+    {
+        directory.createDirectory();
+        index = readIndex();
+    }
+
+    ~SfzDecodedCache()
+    {
+        saveIndex();
+    }
+
+    static bool isCompressed(const File& file)
+    {
+        return file.hasFileExtension("flac;ogg");
+    }
+
+    /**
+     * Get the decoded version of a compressed sample, decoding it if needed.
+     * This can take a while: call it when loading, not from the I/O threads.
+     * Returns a null File if the sample could not be decoded.
+     */
+    File getDecodedFile(const File& compressedFile, AudioFormatManager& formatManager)
+    {
+        const auto entry = directory.getChildFile(getHash(compressedFile) + config::decodedCacheSuffix);
+        if (!entry.existsAsFile() && !decode(compressedFile, entry, formatManager))
+            return {};
+
+        // Keep track of the use for the eviction; the file system might not update the access times by itself
+        entry.setLastAccessTime(Time::getCurrentTime());
+        entriesInUse.insert(entry);
+        return entry;
+    }
+
+    /**
+     * Delete the least recently used entries past the size limit and write the
+     * hash index back. This lists the whole directory: call it once an
+     * instrument is loaded rather than after each sample.
+     */
+    void finishLoading()
+    {
+        evict();
+        saveIndex();
+    }
+
+    /**
+     * Forget the entries in use, e.g. when loading another instrument; they
+     * are not deleted but can be evicted again.
+     */
+    void releaseEntries()
+    {
+        entriesInUse.clear();
+    }
+
+    File getDirectory() const { return directory; }
+    int64 getMaxSize() const noexcept { return maxSize; }
+    int64 getSize() const
+    {
+        int64 size { 0 };
+        for (const auto& entry: directory.findChildFiles(File::findFiles, false, String("*") + config::decodedCacheSuffix))
+            size += entry.getSize();
+        return size;
+    }
+private:
+    struct IndexEntry
+    {
+        int64 size { 0 };
+        int64 modificationTime { 0 };
+        String hash;
+    };
+
+    String getHash(const File& compressedFile)
+    {
+        const auto key = compressedFile.getLinkedTarget().getFullPathName();
+        const auto size = compressedFile.getSize();
+        const auto modificationTime = compressedFile.getLastModificationTime().toMilliseconds();
+        const auto known = index.find(key);
+        if (known != index.end() && known->second.size == size && known->second.modificationTime == modificationTime)
+            return known->second.hash;
+
+        if (index.size() >= config::decodedCacheMaxIndexEntries)
+            index.clear();
+
+        const auto hash = MD5(compressedFile).toHexString();
+        index[key] = { size, modificationTime, hash };
+        indexDirty = true;
+        return hash;
+    }
+
+    std::map<String, IndexEntry> readIndex() const
+    {
+        std::map<String, IndexEntry> entries;
+        const auto indexFile = directory.getChildFile(config::decodedCacheIndexFile);
+        if (!indexFile.existsAsFile())
+            return entries;
+
+        FileInputStream stream { indexFile };
+        if (!stream.openedOk() || stream.readInt() != config::decodedCacheIndexMagic || stream.readInt() != config::decodedCacheIndexVersion)
+            return entries;
+
+        const auto numEntries = stream.readInt();
+        for (int entryIdx = 0; entryIdx < numEntries && !stream.isExhausted(); ++entryIdx)
+        {
+            const auto key = stream.readString();
+            IndexEntry entry;
+            entry.size = stream.readInt64();
+            entry.modificationTime = stream.readInt64();
+            entry.hash = stream.readString();
+            // A truncated entry reads as zeros and an empty hash
+            if (entry.hash.length() != 32)
+                break;
+            entries[key] = entry;
+        }
+        return entries;
+    }
+
+    void saveIndex()
+    {
+        if (!indexDirty)
+            return;
+
+        // Keep what the other instances added since we read the index
+        auto entries = readIndex();
+        for (const auto& entry: index)
+            entries[entry.first] = entry.second;
+        if (entries.size() > config::decodedCacheMaxIndexEntries)
+            entries = index;
+
+        // Write aside and move in place, like the entries
+        TemporaryFile temporaryFile { directory.getChildFile(config::decodedCacheIndexFile) };
+        {
+            FileOutputStream stream { temporaryFile.getFile() };
+            if (!stream.openedOk())
+                return;
+
+            stream.writeInt(config::decodedCacheIndexMagic);
+            stream.writeInt(config::decodedCacheIndexVersion);
+            stream.writeInt(static_cast<int>(entries.size()));
+            for (const auto& entry: entries)
+            {
+                stream.writeString(entry.first);
+                stream.writeInt64(entry.second.size);
+                stream.writeInt64(entry.second.modificationTime);
+                stream.writeString(entry.second.hash);
+            }
+            stream.flush();
+            if (!stream.getStatus().wasOk())
+                return;
+        }
+
+        if (temporaryFile.overwriteTargetFileWithTemporary())
+            indexDirty = false;
+    }
+
+    bool decode(const File& compressedFile, const File& entry, AudioFormatManager& formatManager)
+    {
+        std::unique_ptr<AudioFormatReader> reader { formatManager.createReaderFor(compressedFile) };
+        if (reader == nullptr)
+            return false;
+
+        // Write aside and move in place, so that a partial entry is never picked up; the temporary
+        // file has a unique name, as another instance may be decoding the same sample
+        TemporaryFile temporaryEntry { entry };
+        {
+            auto stream = std::make_unique<FileOutputStream>(temporaryEntry.getFile());
+            if (!stream->openedOk())
+                return false;
+
+            WavAudioFormat wavFormat;
+            std::unique_ptr<AudioFormatWriter> writer { wavFormat.createWriterFor(stream.get(), reader->sampleRate, reader->numChannels, 32, reader->metadataValues, 0) };
+            if (writer == nullptr)
+                return false;
+            stream.release(); // the writer owns the stream now
+
+            if (!writer->writeFromAudioReader(*reader, 0, -1))
+                return false;
+        }
+
+        return temporaryEntry.overwriteTargetFileWithTemporary();
+    }
+
+    void evict()
+    {
+        std::vector<File> entries;
+        int64 size { 0 };
+        for (const auto& entry: directory.findChildFiles(File::findFiles, false, String("*") + config::decodedCacheSuffix))
+        {
+            entries.push_back(entry);
+            size += entry.getSize();
+        }
+
+        if (size <= maxSize)
+            return;
+
+        std::sort(entries.begin(), entries.end(), [](const File& lhs, const File& rhs) {
+            return lhs.getLastAccessTime() < rhs.getLastAccessTime();
+        });
+
+        // The entries in use by the other instances are only known by their access times, set when they loaded them
+        const auto recentlyUsed = Time::getCurrentTime() - protection;
+        for (const auto& entry: entries)
+        {
+            if (size <= maxSize || entry.getLastAccessTime() > recentlyUsed)
+                break;
+
+            if (entriesInUse.find(entry) != entriesInUse.end())
+                continue;
+
+            const auto entrySize = entry.getSize();
+            if (entry.deleteFile())
+                size -= entrySize;
+        }
+    }
+
+    File directory;
+    int64 maxSize;
+    RelativeTime protection;
+    std::set<File> entriesInUse;
+    std::map<String, IndexEntry> index;
+    bool indexDirty { false };
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzDecodedCache)
+};
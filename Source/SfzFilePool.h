@@ -23,16 +23,64 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "JuceHelpers.h"
 #include "SfzGlobals.h"
+#include "SfzGarbageCollector.h"
+#include "SfzChunkPool.h"
+#include "SfzStreamReader.h"
+#include "SfzDecodedCache.h"
+#include "SfzPackedInstrument.h"
+#include "SfzMetadataCache.h"
+#include "SfzMemoryBudget.h"
+#include "SfzLockedArena.h"
+#include "SfzSharedSamples.h"
 #include <memory>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
 
-class SfzFilePool
+/**
+ * Underrun counters, updated from the audio thread when a voice runs out of
+ * preloaded data before the background loading is done.
+ */
+struct SfzSampleStatistics
+{
+    std::atomic<uint32_t> underruns { 0 };
+    std::atomic<uint64_t> starvedFrames { 0 };
+    // Not reset with the underruns: the memory budget uses it to rank the samples
+    std::atomic<uint32_t> plays { 0 };
+
+    void reset() noexcept
+    {
+        underruns = 0;
+        starvedFrames = 0;
+    }
+};
+
+/**
+ * A sample in the file pool, resolved once when the regions are prepared so
+ * that the voices never look samples up by name.
+ */
+using SfzSampleId = int;
+inline constexpr SfzSampleId invalidSampleId { -1 };
+
+class SfzFilePool: public SfzMemoryBudget::Client
 {
 public:
-    SfzFilePool(const File& rootDirectory)
-    : rootDirectory(rootDirectory)
+    SfzFilePool(const File& rootDirectory, SfzMemoryBudget& memoryBudget = SfzMemoryBudget::getInstance(),
+                SfzSharedSamples& sharedSamples = SfzSharedSamples::getInstance())
+    : rootDirectory(rootDirectory), memoryBudget(memoryBudget), sharedSamples(sharedSamples)
     {
         audioFormatManager.registerBasicFormats();
+        metadataCache.setFile(getDefaultMetadataCacheFile());
+        memoryBudget.addClient(this);
+    }
+
+    ~SfzFilePool()
+    {
+        memoryBudget.removeClient(this);
+        clear();
+        memoryBudget.release(SfzMemoryCategory::streaming, getStreamingBytes());
+        metadataCache.save();
     }
 
     void setRootDirectory(const File& directory)
@@ -40,38 +88,167 @@ public:
         if (directory.isDirectory())
             this->rootDirectory = directory;
     }
+
+    /**
+     * The file a sample is read from, following the root directory and any
+     * default_path; a null File for the samples of a packed instrument.
+     */
+    File getSampleFile(const String& sampleName) const
+    {
+        if (packedInstrument != nullptr)
+            return {};
+
+        return rootDirectory.getChildFile(sampleName);
+    }
     
-    void preload(const String& sampleName, int offset = 0, int numSamples = config::preloadSize)
+    /**
+     * Preload the beginning of a sample, up to the offset plus numSamples or
+     * the whole sample if numSamples is 0. Returns the handle to the sample,
+     * or invalidSampleId for generators and samples that could not be read.
+     *
+     * The priority tells the memory budget how likely the sample is to be
+     * played before it has actually been; when the budget is exceeded, the
+     * preloads of the least played and least likely samples are shrunk first.
+     */
+    SfzSampleId preload(const String& sampleName, int offset = 0, int numSamples = config::preloadSize, float priority = 1.0f)
     {        
         if (sampleName.startsWith("*"))
-            return;
+            return invalidSampleId;
 
-        auto reader = createReaderFor(sampleName);
-        if (reader == nullptr)
+        resolveDecodedFile(sampleName);
+
+        // A sample is opened at most once here, for both its information and its preloaded data;
+        // the information usually comes from the cache and the data may already be there
+        std::unique_ptr<SfzStreamReader> reader;
+        auto sampleInfo = findSampleInfo(sampleName);
+        if (!sampleInfo)
         {
-            DBG("Error creating reader for " << sampleName);
-            return;
+            auto formatReader = createReaderFor(sampleName);
+            if (formatReader == nullptr)
+            {
+                DBG("Error creating reader for " << sampleName);
+                return invalidSampleId;
+            }
+
+            sampleInfo = SfzSampleInfo::fromReader(*formatReader);
+            storeSampleInfo(sampleName, *sampleInfo);
+            if (decodedFiles.find(sampleName) == end(decodedFiles))
+                reader = std::make_unique<SfzAudioFormatStreamReader>(std::move(formatReader));
         }
 
-        const int actualNumSamples = [offset, numSamples, &reader](){
-            if (numSamples > 0) 
-                return (int) jmin( (int64)numSamples + offset, reader->lengthInSamples);
-            else
-                return static_cast<int>(reader->lengthInSamples);
-        }();
+        return fillPreload(getSampleId(sampleName), *sampleInfo, std::move(reader), offset, numSamples, priority);
+    }
+
+    /**
+     * Preload a sample registered by registerSample(), once its information
+     * was looked up by getSampleInfo(). This only reads the tables filled in
+     * by these calls and fills the preload buffer, so it can run on another
+     * thread while the loading thread leaves the pool alone.
+     */
+    SfzSampleId preload(SfzSampleId sampleId, int offset = 0, int numSamples = config::preloadSize, float priority = 1.0f)
+    {
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return invalidSampleId;
+
+        const auto sampleInfo = sampleInfos.find(samples[sampleId].name);
+        if (sampleInfo == end(sampleInfos))
+            return invalidSampleId;
 
-        const auto alreadyPreloaded = preloadedData.find(sampleName);
-        if (alreadyPreloaded == end(preloadedData) || alreadyPreloaded->second->getNumSamples() < actualNumSamples)
+        return fillPreload(sampleId, sampleInfo->second, nullptr, offset, numSamples, priority);
+    }
+
+    /**
+     * The identity of a sample file across the synths of the process: its
+     * resolved path and modification time, or the pack it comes from.
+     */
+    String getSampleKey(const String& sampleName) const
+    {
+        const auto file = packedInstrument != nullptr ? packedInstrument->getFile() : rootDirectory.getChildFile(sampleName).getLinkedTarget();
+        auto key = file.getFullPathName() + "@" + String(file.getLastModificationTime().toMilliseconds());
+        if (packedInstrument != nullptr)
+            key << "#" << sampleName;
+        return key;
+    }
+
+    // Number of preloads served by the data of another synth since the last clear()
+    int getNumSharedPreloads() const noexcept { return numSharedPreloads; }
+
+    /**
+     * Get the handle to a sample without preloading it; preload() fills it in
+     * later and the voices find no preloaded data until then. Compressed
+     * samples are decoded to the cache here already, on the loading thread.
+     */
+    SfzSampleId registerSample(const String& sampleName)
+    {
+        if (sampleName.startsWith("*"))
+            return invalidSampleId;
+
+        resolveDecodedFile(sampleName);
+        return getSampleId(sampleName);
+    }
+    /**
+     * Free the preloaded data of a sample; it can be preloaded again later.
+     * The voices playing it keep the data until they end.
+     */
+    void unload(SfzSampleId sampleId)
+    {
+        std::lock_guard<std::mutex> lock { sampleMutex };
+        if (sampleId >= 0 && sampleId < static_cast<int>(samples.size()))
+            replacePreloadedData(samples[sampleId], nullptr);
+    }
+
+    /**
+     * Create a reader to stream a sample from. Compressed samples are read
+     * from the decoded cache if it is enabled. On Linux, uncompressed wav files
+     * are read through io_uring when the kernel allows it; everything else goes
+     * through the JUCE audio format readers. Packed samples are read from
+     * the pack, through io_uring or its memory mapping.
+     */
+    std::unique_ptr<SfzStreamReader> createStreamReader(const String& sampleName)
+    {
+        if (packedInstrument != nullptr)
         {
-            preloadedData[sampleName] = std::make_shared<AudioBuffer<float>>(config::numChannels, actualNumSamples);
-            preloadedData[sampleName]->clear();
-            reader->read(preloadedData[sampleName].get(), 0, actualNumSamples, 0, true, true);
+#if SFZ_IO_URING
+            if (const auto* entry = packedInstrument->getEntry(sampleName))
+            {
+                if (auto reader = SfzUringStreamReader::create(packedInstrument->getFileDescriptor(), entry->offset))
+                    return reader;
+            }
+#endif
+            auto reader = packedInstrument->createReaderFor(sampleName);
+            if (reader == nullptr)
+                return {};
+
+            return std::make_unique<SfzAudioFormatStreamReader>(std::move(reader));
+        }
+
+        const auto decodedFile = decodedFiles.find(sampleName);
+        const File sampleFile { decodedFile != end(decodedFiles) ? decodedFile->second : rootDirectory.getChildFile(sampleName) };
+#if SFZ_IO_URING
+        if (auto reader = SfzUringStreamReader::create(sampleFile))
+            return reader;
+#endif
+        if (decodedFile != end(decodedFiles))
+        {
+            // Decoded samples are plain float wav files which we can map instead of reading
+            std::unique_ptr<MemoryMappedAudioFormatReader> mappedReader { WavAudioFormat().createMemoryMappedReader(sampleFile) };
+            if (mappedReader != nullptr && mappedReader->mapEntireFile())
+                return std::make_unique<SfzAudioFormatStreamReader>(std::move(mappedReader));
         }
+
+        auto reader = createReaderFor(sampleName);
+        if (reader == nullptr)
+            return {};
+
+        return std::make_unique<SfzAudioFormatStreamReader>(std::move(reader));
     }
 
     std::unique_ptr<AudioFormatReader> createReaderFor(const String& sampleName)
     {
-        File sampleFile { rootDirectory.getChildFile(sampleName) };
+        if (packedInstrument != nullptr)
+            return packedInstrument->createReaderFor(sampleName);
+
+        const auto sampleFile = getSampleFile(sampleName);
         if (!sampleFile.existsAsFile())
         {
             DBG("Can't find file " << sampleName );
@@ -80,22 +257,515 @@ public:
         return std::unique_ptr<AudioFormatReader>(audioFormatManager.createReaderFor(sampleFile));
     }
 
+    /**
+     * Sample rate, channels, length and loop points of a sample. This only
+     * opens the sample if it was neither preloaded nor seen in a previous
+     * session; packed instruments take it from their index.
+     */
+    std::optional<SfzSampleInfo> getSampleInfo(const String& sampleName)
+    {
+        if (auto sampleInfo = findSampleInfo(sampleName))
+            return sampleInfo;
+
+        auto reader = createReaderFor(sampleName);
+        if (reader == nullptr)
+            return {};
+
+        const auto sampleInfo = SfzSampleInfo::fromReader(*reader);
+        storeSampleInfo(sampleName, sampleInfo);
+        return sampleInfo;
+    }
+
+    /**
+     * The metadata cache file the pools start with, in the user application
+     * data directory unless set otherwise. Set it before creating the pools,
+     * e.g. to keep the tests away from the cache of the user.
+     */
+    static File getDefaultMetadataCacheFile() { return defaultMetadataCacheFile(); }
+    static void setDefaultMetadataCacheFile(const File& cacheFile) { defaultMetadataCacheFile() = cacheFile; }
+
+    /**
+     * Keep the sample information between sessions in another file, or only
+     * in memory with a null File.
+     */
+    void setMetadataCacheFile(const File& cacheFile)
+    {
+        metadataCache.setFile(cacheFile);
+    }
+
+    // Write the sample information gathered so far and trim the decoded cache; call this once an instrument is loaded
+    void finishLoading()
+    {
+        if (!metadataCache.save())
+            DBG("Could not write the sample metadata cache " << metadataCache.getFile().getFullPathName());
+
+        if (decodedCache != nullptr)
+            decodedCache->finishLoading();
+    }
+
+    /**
+     * Read the samples from a packed instrument rather than from the root
+     * directory, until the next call to clear().
+     */
+    void setPackedInstrument(std::shared_ptr<SfzPackedInstrument> instrument)
+    {
+        packedInstrument = std::move(instrument);
+    }
+
+    /**
+     * Carve the preloaded data from now on out of a single region of the given
+     * size, locked into RAM and touched beforehand, so that the audio thread
+     * never faults on it. Returns false if the region could not be locked, in
+     * which case the preloads stay on the heap; getLockedMemoryStatus() says why.
+     * Preloads that do not fit in the region also go on the heap and are
+     * counted by getNumUnlockedPreloads().
+     */
+    bool enableLockedMemory(int64 sizeInBytes, bool useHugePages = false)
+    {
+        auto arena = std::make_shared<SfzLockedArena>(static_cast<size_t>(jmax(sizeInBytes, int64 { 0 })), useHugePages);
+        lockedMemoryStatus = arena->getStatus();
+        if (!arena->isValid())
+        {
+            DBG("Preloaded data will not be locked into memory: " << lockedMemoryStatus);
+            lockedArena.reset();
+            return false;
+        }
+
+        lockedArena = std::move(arena);
+        return true;
+    }
+
+    // The buffers already carved keep the region alive until they are released
+    void disableLockedMemory()
+    {
+        lockedArena.reset();
+        lockedMemoryStatus = {};
+    }
+
+    String getLockedMemoryStatus() const { return lockedMemoryStatus; }
+    int getNumUnlockedPreloads() const noexcept { return numUnlockedPreloads; }
+
+    /**
+     * Keep decoded versions of the compressed samples in a directory, up to a
+     * size in bytes. This applies to the samples preloaded from now on.
+     */
+    void enableDecodedCache(const File& directory, int64 maxSizeInBytes = config::decodedCacheSize)
+    {
+        decodedCache = std::make_unique<SfzDecodedCache>(directory, maxSizeInBytes);
+    }
+
+    void disableDecodedCache()
+    {
+        decodedCache.reset();
+        decodedFiles.clear();
+    }
+
     void clear()
     {
-        preloadedData.clear();
+        {
+            std::lock_guard<std::mutex> lock { sampleMutex };
+            for (auto& sample: samples)
+                replacePreloadedData(sample, nullptr);
+            samples.clear();
+        }
+        sampleIds.clear();
+        sampleInfos.clear();
+        numUnlockedPreloads = 0;
+        numSharedPreloads = 0;
+        packedInstrument.reset();
+        decodedFiles.clear();
+        if (decodedCache != nullptr)
+            decodedCache->releaseEntries();
+        instrumentStatistics.reset();
+    }
+
+    using PreloadHazard = SfzGarbageCollector<AudioBuffer<float>>::Hazard;
+
+    // The voices register the hazard through which they read the preloaded data
+    void addPreloadHazard(PreloadHazard& hazard) { garbageCollector.addHazard(hazard); }
+    void removePreloadHazard(PreloadHazard& hazard) { garbageCollector.removeHazard(hazard); }
+
+    /**
+     * The preloaded data of a sample, kept alive until the hazard is cleared
+     * by releasePreloadedData() even if the memory budget or an unload
+     * replaces it in the meantime. This takes no lock: use it from the audio
+     * thread, the hazard being registered with addPreloadHazard().
+     */
+    AudioBuffer<float>* getPreloadedData(SfzSampleId sampleId, PreloadHazard& hazard) const noexcept
+    {
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return nullptr;
+
+        return SfzGarbageCollector<AudioBuffer<float>>::acquire(*samples[sampleId].publishedData, hazard);
+    }
+
+    static void releasePreloadedData(PreloadHazard& hazard) noexcept
+    {
+        SfzGarbageCollector<AudioBuffer<float>>::release(hazard);
     }
 
-    std::shared_ptr<AudioBuffer<float>> getPreloadedData(const String& sampleName)
+    // A reference to the preloaded data of a sample; this can lock, so not from the audio thread
+    std::shared_ptr<AudioBuffer<float>> getPreloadedData(SfzSampleId sampleId) const
     {
-        auto data = preloadedData.find(sampleName);
-        if (data != end(preloadedData))
-            return data->second;
-        
-        return {};
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return {};
+
+        return std::atomic_load(&samples[sampleId].preloadedData);
     }
 
+    SfzSampleStatistics* getStatistics(SfzSampleId sampleId) const noexcept
+    {
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return {};
+
+        return samples[sampleId].statistics.get();
+    }
+
+    // The regions playing a sample keep a copy of this name, so that they all share its storage
+    String getSampleName(SfzSampleId sampleId) const
+    {
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return {};
+
+        return samples[sampleId].name;
+    }
+
+    void registerUnderrun(SfzSampleStatistics* statistics) noexcept
+    {
+        instrumentStatistics.underruns++;
+        if (statistics != nullptr)
+            statistics->underruns++;
+    }
+
+    void registerStarvedFrames(SfzSampleStatistics* statistics, int numFrames) noexcept
+    {
+        instrumentStatistics.starvedFrames += numFrames;
+        if (statistics != nullptr)
+            statistics->starvedFrames += numFrames;
+    }
+
+    const SfzSampleStatistics& getInstrumentStatistics() const noexcept { return instrumentStatistics; }
+
+    std::map<String, uint32_t> getUnderrunsPerSample() const
+    {
+        std::map<String, uint32_t> underruns;
+        for (auto& sample: samples)
+        {
+            if (sample.statistics->underruns > 0)
+                underruns[sample.name] = sample.statistics->underruns;
+        }
+        return underruns;
+    }
+
+    void resetStatistics() noexcept
+    {
+        instrumentStatistics.reset();
+        for (auto& sample: samples)
+            sample.statistics->reset();
+    }
+
+    /**
+     * Size the streaming chunks for the given voice count and block size.
+     * The chunks must all have been returned, i.e. the voices reset.
+     */
+    void prepareStreaming(int numVoices, int samplesPerBlock)
+    {
+        // A chunk has to outlast a few blocks even when playing fast, and the
+        // ring of a voice should hold more than the preloaded head of the samples
+        const auto chunkSize = jmax(config::preloadSize / 2, 4 * samplesPerBlock);
+        memoryBudget.release(SfzMemoryCategory::streaming, getStreamingBytes());
+        chunkPool.allocate(jmax(numVoices, 1) * config::streamingChunksPerVoice, chunkSize);
+        memoryBudget.allocate(SfzMemoryCategory::streaming, getStreamingBytes());
+    }
+
+    AudioBuffer<float>* acquireChunk() noexcept { return chunkPool.acquire(); }
+    void releaseChunk(AudioBuffer<float>*& chunk) noexcept { chunkPool.release(chunk); }
+    int getChunkSize() const noexcept { return chunkPool.getChunkSize(); }
+
+    // Memory used by this pool, in bytes; the preloads shared with other synths count for each of them
+    int64 getPreloadedBytes() const noexcept { return preloadedBytes; }
+    int64 getStreamingBytes() const noexcept
+    {
+        return static_cast<int64>(chunkPool.getNumChunks()) * chunkPool.getChunkSize() * config::numChannels * static_cast<int64>(sizeof(float));
+    }
+
+    void addEvictionCandidates(std::vector<SfzMemoryBudget::EvictionCandidate>& candidates) override
+    {
+        std::lock_guard<std::mutex> lock { sampleMutex };
+        for (int sampleIdx = 0; sampleIdx < static_cast<int>(samples.size()); ++sampleIdx)
+        {
+            const auto& sample = samples[sampleIdx];
+            const auto preloadedData = std::atomic_load(&sample.preloadedData);
+            if (preloadedData == nullptr || preloadedData->getNumSamples() <= getMinimumPreloadSize(sample))
+                continue;
+
+            // Shrinking the data shared with other synths frees nothing while they hold it
+            if (isShared(preloadedData))
+                continue;
+
+            // Samples that were played come before any that were not, and among those the likelier ones first
+            const auto priority = static_cast<float>(sample.statistics->plays) + jlimit(0.0f, 1.0f, sample.priority);
+            const auto reclaimableFrames = preloadedData->getNumSamples() - getMinimumPreloadSize(sample);
+            candidates.push_back({ this, sampleIdx, priority, getSizeInBytes(reclaimableFrames) });
+        }
+    }
+
+    /**
+     * Shrink the preloaded data of a sample down to what the voices need to
+     * start while the rest streams in. The voices playing the sample, and the
+     * other synths sharing it, keep the previous data until they let it go:
+     * nothing is freed then, and this returns 0.
+     */
+    int64 evict(int sampleId) override
+    {
+        std::lock_guard<std::mutex> lock { sampleMutex };
+        if (sampleId < 0 || sampleId >= static_cast<int>(samples.size()))
+            return 0;
+
+        auto& sample = samples[sampleId];
+        auto preloadedData = std::atomic_load(&sample.preloadedData);
+        const auto numFrames = getMinimumPreloadSize(sample);
+        if (preloadedData == nullptr || preloadedData->getNumSamples() <= numFrames)
+            return 0;
+
+        // The shrunk copy would only add to the usage while a voice or another synth holds the data
+        if (isShared(preloadedData) || garbageCollector.isProtected(preloadedData.get()))
+            return 0;
+
+        auto shrunkData = createPreloadBuffer(numFrames);
+        for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
+            shrunkData->copyFrom(channelIdx, 0, *preloadedData, channelIdx, 0, numFrames);
+
+        const auto freedBytes = getSizeInBytes(preloadedData->getNumSamples() - numFrames);
+        const std::weak_ptr<AudioBuffer<float>> previousData { preloadedData };
+        preloadedData.reset();
+        replacePreloadedData(sample, std::move(shrunkData));
+        return previousData.expired() ? freedBytes : 0;
+    }
 private:
+    static File& defaultMetadataCacheFile()
+    {
+        static File cacheFile { File::getSpecialLocation(File::userApplicationDataDirectory).getChildFile(config::metadataCacheFile) };
+        return cacheFile;
+    }
+
+    // Whether another synth uses the data, given a copy of the reference of the sample holding it
+    static bool isShared(const std::shared_ptr<AudioBuffer<float>>& preloadedData) noexcept
+    {
+        return preloadedData.use_count() > 2;
+    }
+
+    static int64 getSizeInBytes(int numFrames) noexcept
+    {
+        return static_cast<int64>(numFrames) * config::numChannels * static_cast<int64>(sizeof(float));
+    }
+
+    SfzSampleId getSampleId(const String& sampleName)
+    {
+        const auto known = sampleIds.find(sampleName);
+        if (known != end(sampleIds))
+            return known->second;
+
+        std::lock_guard<std::mutex> lock { sampleMutex };
+        const auto sampleId = static_cast<SfzSampleId>(samples.size());
+        samples.push_back({ sampleName, nullptr, std::make_unique<std::atomic<AudioBuffer<float>*>>(nullptr), std::make_unique<SfzSampleStatistics>() });
+        sampleIds[sampleName] = sampleId;
+        return sampleId;
+    }
+
+    // Decode a compressed sample to the cache if it is enabled; this writes the tables, so only call it from the loading thread
+    void resolveDecodedFile(const String& sampleName)
+    {
+        if (packedInstrument != nullptr || decodedCache == nullptr || decodedFiles.find(sampleName) != end(decodedFiles))
+            return;
+
+        const auto sampleFile = getSampleFile(sampleName);
+        if (SfzDecodedCache::isCompressed(sampleFile))
+        {
+            const auto decodedFile = decodedCache->getDecodedFile(sampleFile, audioFormatManager);
+            if (decodedFile.existsAsFile())
+                decodedFiles[sampleName] = decodedFile;
+        }
+    }
+
+    // The reader is the one the information was read from, if any, so that the sample is not opened twice
+    SfzSampleId fillPreload(SfzSampleId sampleId, const SfzSampleInfo& sampleInfo, std::unique_ptr<SfzStreamReader> reader, int offset, int numSamples, float priority)
+    {
+        const int actualNumSamples = [offset, numSamples, &sampleInfo](){
+            if (numSamples > 0) 
+                return (int) jmin( (int64)numSamples + offset, sampleInfo.lengthInSamples);
+            else
+                return static_cast<int>(sampleInfo.lengthInSamples);
+        }();
+
+        auto& sample = samples[sampleId];
+        const auto preloadedData = std::atomic_load(&sample.preloadedData);
+        if (preloadedData == nullptr || preloadedData->getNumSamples() < actualNumSamples)
+        {
+            // Another synth of the process may have preloaded it already
+            const auto sampleKey = getSampleKey(sample.name);
+            auto newData = sharedSamples.find(sampleKey, actualNumSamples);
+            if (newData != nullptr)
+            {
+                numSharedPreloads++;
+                if (lockedArena != nullptr)
+                {
+                    // The data of the other synth may not be locked: copy it into our arena rather than risk a page fault on the audio thread
+                    auto lockedData = createPreloadBuffer(actualNumSamples);
+                    for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
+                        lockedData->copyFrom(channelIdx, 0, *newData, channelIdx, 0, actualNumSamples);
+                    newData = std::move(lockedData);
+                }
+            }
+            else
+            {
+                if (reader == nullptr)
+                    reader = createStreamReader(sample.name);
+
+                if (reader == nullptr)
+                {
+                    DBG("Error creating reader for " << sample.name);
+                    return invalidSampleId;
+                }
+
+                newData = createPreloadBuffer(actualNumSamples);
+                newData->clear();
+                const SfzStreamReader::Segment wholePreload { newData.get(), 0, 0, actualNumSamples };
+                reader->read(&wholePreload, 1);
+                sharedSamples.publish(sampleKey, newData);
+            }
+
+            std::lock_guard<std::mutex> lock { sampleMutex };
+            replacePreloadedData(sample, std::move(newData));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock { sampleMutex };
+            sample.maxOffset = jmax(sample.maxOffset, offset);
+            sample.priority = jmax(sample.priority, priority);
+        }
+
+        if (memoryBudget.isOverLimit())
+            memoryBudget.enforce();
+
+        return sampleId;
+    }
+
+
+    std::optional<SfzSampleInfo> findSampleInfo(const String& sampleName)
+    {
+        const auto known = sampleInfos.find(sampleName);
+        if (known != end(sampleInfos))
+            return known->second;
+
+        std::optional<SfzSampleInfo> sampleInfo;
+        if (packedInstrument != nullptr)
+        {
+            if (const auto* entry = packedInstrument->getEntry(sampleName))
+                sampleInfo = entry->info;
+        }
+        else
+        {
+            sampleInfo = metadataCache.find(rootDirectory.getChildFile(sampleName));
+        }
+
+        if (sampleInfo)
+            sampleInfos[sampleName] = *sampleInfo;
+        return sampleInfo;
+    }
+
+    void storeSampleInfo(const String& sampleName, const SfzSampleInfo& sampleInfo)
+    {
+        sampleInfos[sampleName] = sampleInfo;
+        if (packedInstrument == nullptr)
+            metadataCache.store(rootDirectory.getChildFile(sampleName), sampleInfo);
+    }
+
     File rootDirectory;
     AudioFormatManager audioFormatManager;
-    std::map<String, std::shared_ptr<AudioBuffer<float>>> preloadedData;
+    struct Sample
+    {
+        String name;
+        std::shared_ptr<AudioBuffer<float>> preloadedData;
+        std::unique_ptr<std::atomic<AudioBuffer<float>*>> publishedData; // The same buffer, for the audio thread
+        std::unique_ptr<SfzSampleStatistics> statistics;
+        int maxOffset { 0 };
+        float priority { 0.0f };
+    };
+
+    std::shared_ptr<AudioBuffer<float>> createPreloadBuffer(int numFrames)
+    {
+        if (lockedArena != nullptr)
+        {
+            const auto numBytes = sizeof(float) * config::numChannels * static_cast<size_t>(numFrames);
+            if (auto* data = static_cast<float*>(lockedArena->allocate(numBytes)))
+            {
+                float* channels[config::numChannels];
+                for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
+                    channels[channelIdx] = data + static_cast<size_t>(numFrames) * channelIdx;
+
+                // The deleter holds on to the arena, which can then be replaced while buffers are in use
+                memoryBudget.allocate(SfzMemoryCategory::preload, getSizeInBytes(numFrames));
+                return std::shared_ptr<AudioBuffer<float>>(new AudioBuffer<float>(channels, config::numChannels, numFrames),
+                    [arena = lockedArena, data, numBytes, budget = &memoryBudget](AudioBuffer<float>* buffer) {
+                        budget->release(SfzMemoryCategory::preload, getSizeInBytes(buffer->getNumSamples()));
+                        delete buffer;
+                        arena->release(data, numBytes);
+                    });
+            }
+
+            if (numUnlockedPreloads++ == 0)
+                DBG("The locked memory is full; the next preloads are not locked");
+        }
+
+        // The buffers can be shared with other synths, so they are accounted for until the last one lets go
+        memoryBudget.allocate(SfzMemoryCategory::preload, getSizeInBytes(numFrames));
+        return std::shared_ptr<AudioBuffer<float>>(new AudioBuffer<float>(config::numChannels, numFrames),
+            [budget = &memoryBudget](AudioBuffer<float>* buffer) {
+                budget->release(SfzMemoryCategory::preload, getSizeInBytes(buffer->getNumSamples()));
+                delete buffer;
+            });
+    }
+
+    static int getMinimumPreloadSize(const Sample& sample) noexcept
+    {
+        return sample.maxOffset + config::minimumPreloadSize;
+    }
+
+    // Call with the sample mutex held
+    void replacePreloadedData(Sample& sample, std::shared_ptr<AudioBuffer<float>> newData)
+    {
+        auto previousData = std::atomic_load(&sample.preloadedData);
+        if (previousData != nullptr)
+            preloadedBytes -= getSizeInBytes(previousData->getNumSamples());
+
+        if (newData != nullptr)
+            preloadedBytes += getSizeInBytes(newData->getNumSamples());
+
+        // The voices may still read the previous buffer, so the garbage collector keeps it until their hazards
+        // let go; otherwise it is freed right away, and the memory budget sees the usage drop
+        sample.publishedData->store(newData.get());
+        std::atomic_store(&sample.preloadedData, std::move(newData));
+        garbageCollector.retireWhenUnused(std::move(previousData));
+        garbageCollector.collect();
+    }
+
+    std::vector<Sample> samples;
+    std::map<String, SfzSampleId> sampleIds;
+    std::map<String, SfzSampleInfo> sampleInfos;
+    SfzMetadataCache metadataCache;
+    std::shared_ptr<SfzPackedInstrument> packedInstrument;
+    std::unique_ptr<SfzDecodedCache> decodedCache;
+    std::map<String, File> decodedFiles;
+    SfzSampleStatistics instrumentStatistics;
+    SfzGarbageCollector<AudioBuffer<float>> garbageCollector;
+    SfzChunkPool chunkPool;
+    SfzMemoryBudget& memoryBudget;
+    SfzSharedSamples& sharedSamples;
+    std::atomic<int> numSharedPreloads { 0 };
+    std::mutex sampleMutex;
+    std::atomic<int64> preloadedBytes { 0 };
+    std::shared_ptr<SfzLockedArena> lockedArena;
+    String lockedMemoryStatus;
+    std::atomic<int> numUnlockedPreloads { 0 };
 };
\ No newline at end of file
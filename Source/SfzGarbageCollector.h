@@ -0,0 +1,155 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Keeps the objects published through a plain atomic pointer alive while the
+ * audio thread reads them, so that it never touches a reference count or a
+ * lock and never frees memory.
+ *
+ * A reader shows the object it uses in a hazard registered here. When the
+ * owner replaces the published object, it hands the previous one over; the
+ * collector drops it right away if no hazard points to it, or later on its
+ * background thread once the hazards let it go.
+ */
+template<class T>
+class SfzGarbageCollector: private Thread
+{
+public:
+    SfzGarbageCollector()
+    : Thread("SfzGarbageCollector")
+    {
+        startThread();
+    }
+
+    using Hazard = std::atomic<T*>;
+
+    ~SfzGarbageCollector()
+    {
+        stopThread(config::garbageCollectionPeriod * 4);
+        // The readers are gone by now
+        jassert(hazards.empty());
+        replaced.clear();
+    }
+
+    // Register the hazard of a reader; not from the audio thread
+    void addHazard(Hazard& hazard)
+    {
+        std::lock_guard<std::mutex> lock { hazardMutex };
+        hazards.push_back(&hazard);
+    }
+
+    void removeHazard(Hazard& hazard)
+    {
+        std::lock_guard<std::mutex> lock { hazardMutex };
+        hazards.erase(std::remove(hazards.begin(), hazards.end(), &hazard), hazards.end());
+    }
+
+    /**
+     * Read the object published in a pointer and protect it with a hazard,
+     * until the hazard is cleared. This is lock-free and safe to call from the
+     * audio thread.
+     */
+    static T* acquire(const std::atomic<T*>& published, Hazard& hazard) noexcept
+    {
+        auto* object = published.load();
+        for (;;)
+        {
+            // The object may have been replaced before the hazard showed it: check again
+            hazard.store(object);
+            auto* current = published.load();
+            if (current == object)
+                return object;
+            object = current;
+        }
+    }
+
+    static void release(Hazard& hazard) noexcept
+    {
+        hazard.store(nullptr, std::memory_order_release);
+    }
+
+    // Whether a hazard points to the object; this can change right after the call
+    bool isProtected(const T* object)
+    {
+        std::lock_guard<std::mutex> lock { hazardMutex };
+        return isPointedTo(object);
+    }
+
+    /**
+     * Keep an object that was replaced in its published pointer until no
+     * hazard points to it. Not from the audio thread, as this can allocate.
+     */
+    void retireWhenUnused(std::shared_ptr<T> object)
+    {
+        if (object == nullptr)
+            return;
+
+        std::lock_guard<std::mutex> lock { hazardMutex };
+        replaced.push_back(std::move(object));
+    }
+
+    // Drop the replaced objects that no hazard points to
+    void collect() noexcept
+    {
+        // The objects are dropped out of the lock, so that the readers registering are not held up by the frees
+        std::vector<std::shared_ptr<T>> collected;
+        {
+            std::lock_guard<std::mutex> lock { hazardMutex };
+            const auto firstFree = std::stable_partition(replaced.begin(), replaced.end(), [this](const std::shared_ptr<T>& candidate) {
+                return isPointedTo(candidate.get());
+            });
+            std::move(firstFree, replaced.end(), std::back_inserter(collected));
+            replaced.erase(firstFree, replaced.end());
+        }
+        collected.clear();
+    }
+private:
+    // Call with the hazard mutex held
+    bool isPointedTo(const T* object) const noexcept
+    {
+        return std::any_of(hazards.begin(), hazards.end(), [object](const Hazard* hazard) {
+            return hazard->load() == object;
+        });
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            wait(config::garbageCollectionPeriod);
+            collect();
+        }
+    }
+
+    std::mutex hazardMutex;
+    std::vector<Hazard*> hazards;
+    std::vector<std::shared_ptr<T>> replaced; // Replaced objects waiting for the hazards to let them go
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzGarbageCollector)
+};
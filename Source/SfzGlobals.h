@@ -39,9 +39,43 @@ namespace config
     inline constexpr int numVoices { 64 };
     inline constexpr int maxGroups { 32 };
     inline constexpr int numLoadingThreads { 4 };
+    inline constexpr int ioThreadPriority { 7 };
+    inline constexpr int ioQueueSize { 4 * numVoices };
+    inline constexpr int ioPollingPeriod { 10 }; // milliseconds
+    inline constexpr int ioThreadStopTimeout { 1000 }; // milliseconds
+    inline constexpr int articulationSelectionQueueSize { 128 };
+    inline constexpr int articulationLoaderPriority { 4 };
+    inline constexpr int articulationLoaderPeriod { 50 }; // milliseconds
+    inline constexpr int garbageCollectionPeriod { 50 }; // milliseconds
+    inline constexpr int streamingChunksPerVoice { 4 };
+    inline constexpr int uringQueueDepth { 64 };
+    inline constexpr size_t uringStagingSize { 1 << 20 }; // bytes, per I/O thread
+    inline constexpr int uringSubmitAttempts { 4 }; // in a row without the kernel taking any read
+    inline constexpr int64_t decodedCacheSize { int64_t(4) << 30 }; // bytes
+    inline constexpr char decodedCacheSuffix[] { "-f32-v1.wav" };
+    inline constexpr char decodedCacheIndexFile[] { "hashes.index" };
+    inline constexpr int decodedCacheIndexMagic { 0x48445a53 }; // "SZDH"
+    inline constexpr int decodedCacheIndexVersion { 1 };
+    inline constexpr size_t decodedCacheMaxIndexEntries { 1 << 16 };
+    inline constexpr int decodedCacheProtectionHours { 24 }; // entries used more recently are not evicted
+    inline constexpr char packedInstrumentExtension[] { "sfzpack" };
+    inline constexpr int packMagic { 0x4b505a53 }; // "SZPK"
+    inline constexpr int packVersion { 1 };
+    inline constexpr int64_t packAlignment { 4096 }; // bytes
+    inline constexpr char metadataCacheFile[] { "sfizz/sample-metadata.cache" }; // in the user application data directory
+    inline constexpr int metadataCacheMagic { 0x444d5a53 }; // "SZMD"
+    inline constexpr int metadataCacheVersion { 1 };
+    inline constexpr size_t metadataCacheMaxEntries { 1 << 16 };
+    inline constexpr int minimumPreloadSize { 4096 }; // frames left when the memory budget shrinks a preload
+    inline constexpr size_t lockedMemoryAlignment { 64 }; // bytes
+    inline constexpr size_t hugePageSize { 2 << 20 }; // bytes
+    inline constexpr double memoryBudgetHysteresis { 0.9 }; // fraction of the limit to get back to when reclaiming
     inline constexpr int midiFeedbackCapacity { numVoices };
     inline constexpr int centPerSemitone { 100 };
+    inline constexpr int renderQuantum { 128 }; // frames rendered at once by the voices, whatever the block size
+    inline constexpr int minimumRenderSlice { 16 }; // frames; closer MIDI events are rendered in the same slice
     inline constexpr int loopCrossfadeLength { 64 };
+    inline constexpr int underrunFadeLength { 64 };
     inline constexpr float virtuallyZero { 0.00005f };
     inline constexpr double fastReleaseDuration { 0.01 };
     inline constexpr int leftChan { 0 };
@@ -61,16 +95,11 @@ namespace SfzRegexes
 
 inline constexpr unsigned int Fnv1aBasis = 0x811C9DC5;
 inline constexpr unsigned int Fnv1aPrime = 0x01000193;
-inline constexpr unsigned int hash(const char *s, unsigned int h = Fnv1aBasis)
+// FNV-1a, usable in case labels as well as on the opcodes read at runtime
+inline constexpr unsigned int hash(std::string_view s, unsigned int h = Fnv1aBasis)
 {
-    return !*s ? h : hash(s + 1, static_cast<unsigned int>((h ^ *s) * static_cast<unsigned long long>(Fnv1aPrime)));
-}
-
-inline unsigned int hash(std::string_view s, unsigned int h = Fnv1aBasis)
-{
-    if (s.length() > 0)
-        return hash(std::string_view(s.data() + 1, s.length() - 1), static_cast<unsigned int>((h ^ s.front()) * static_cast<unsigned long long>(Fnv1aPrime)));
-
+    for (auto c: s)
+        h = static_cast<unsigned int>((h ^ c) * static_cast<unsigned long long>(Fnv1aPrime));
     return h;
 }
 
@@ -0,0 +1,193 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include "SfzLockFreeQueue.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+enum class SfzIORequestType { load, stream, release };
+
+/**
+ * Something that can be served by the I/O threads, typically a voice.
+ */
+class SfzIOJob
+{
+public:
+    virtual ~SfzIOJob() = default;
+    virtual void runIORequest(SfzIORequestType type) = 0;
+    // Number of output frames before the job runs out of data; lower is more urgent
+    virtual int getRemainingFrames() const noexcept { return std::numeric_limits<int>::max(); }
+};
+
+struct SfzIORequest
+{
+    SfzIORequestType type { SfzIORequestType::load };
+    SfzIOJob* job { nullptr };
+};
+
+/**
+ * Dispatches load, stream and release requests to a set of background I/O threads.
+ * push() is safe to call from the audio thread: it only writes a small request
+ * in a preallocated lock-free queue and never blocks nor allocates. It does not
+ * wake the threads either, which would take a lock and a system call: they
+ * poll their queue every config::ioPollingPeriod, which is well within what
+ * the preloaded data and the streaming chunks of a voice can play.
+ *
+ * All the requests for a given job are served by the same thread, so a release
+ * is never processed while a load for the same voice is in flight. Pending reads
+ * (loads and streams) are served by deadline rather than in submission order:
+ * the job that will starve first is read first, and a job has at most one read
+ * pending at a time. Releases are cheap and served as soon as they arrive,
+ * cancelling any read still pending for the same job.
+ */
+class SfzIOQueue
+{
+public:
+    SfzIOQueue(int numThreads = config::numLoadingThreads)
+    {
+        for (int threadIdx = 0; threadIdx < jmax(numThreads, 1); ++threadIdx)
+            threads.push_back(std::make_unique<IOThread>());
+        start();
+    }
+
+    ~SfzIOQueue()
+    {
+        stop();
+    }
+
+    bool push(SfzIORequest request) noexcept
+    {
+        jassert(request.job != nullptr);
+        auto& thread = *threads[getThreadIndex(request.job)];
+        return thread.requests.push(std::move(request));
+    }
+
+    void start()
+    {
+        for (auto& thread: threads)
+            thread->startThread(config::ioThreadPriority);
+    }
+
+    /**
+     * Stop the I/O threads and discard the pending requests.
+     * Call this before destroying any of the jobs that may still be queued.
+     */
+    void stop()
+    {
+        for (auto& thread: threads)
+        {
+            thread->signalThreadShouldExit();
+            thread->notify();
+        }
+
+        SfzIORequest discarded;
+        for (auto& thread: threads)
+        {
+            thread->stopThread(config::ioThreadStopTimeout);
+            while (thread->requests.pop(discarded)) { }
+        }
+    }
+
+    int getNumThreads() const noexcept { return static_cast<int>(threads.size()); }
+private:
+    size_t getThreadIndex(const SfzIOJob* job) const noexcept
+    {
+        // Jobs are large objects so the low bits of their address are not worth much
+        const auto address = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(job));
+        return static_cast<size_t>(((address >> 6) * 0x9E3779B97F4A7C15ull) >> 32) % threads.size();
+    }
+
+    struct IOThread: public Thread
+    {
+        IOThread()
+        : Thread("SfzIOThread"), requests(config::ioQueueSize)
+        {
+            pendingReads.reserve(config::ioQueueSize);
+        }
+
+        void run() override
+        {
+            pendingReads.clear();
+            while (!threadShouldExit())
+            {
+                collectRequests();
+
+                if (!pendingReads.empty())
+                {
+                    runMostUrgentRead();
+                    continue;
+                }
+
+                if (requests.empty())
+                    wait(config::ioPollingPeriod);
+            }
+            pendingReads.clear();
+        }
+
+        void collectRequests()
+        {
+            SfzIORequest request;
+            while (requests.pop(request))
+            {
+                auto pending = std::find_if(pendingReads.begin(), pendingReads.end(), [&request](const auto& read) {
+                    return read.job == request.job;
+                });
+
+                switch (request.type)
+                {
+                case SfzIORequestType::load:
+                case SfzIORequestType::stream:
+                    // A pending load also does the streaming work, so keep the first request
+                    if (pending == pendingReads.end())
+                        pendingReads.push_back(request);
+                    break;
+                case SfzIORequestType::release:
+                    if (pending != pendingReads.end())
+                        pendingReads.erase(pending);
+                    request.job->runIORequest(SfzIORequestType::release);
+                    break;
+                }
+            }
+        }
+
+        void runMostUrgentRead()
+        {
+            // Deadlines move as the voices play so they are read again each time
+            auto mostUrgent = std::min_element(pendingReads.begin(), pendingReads.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.job->getRemainingFrames() < rhs.job->getRemainingFrames();
+            });
+            const auto read = *mostUrgent;
+            *mostUrgent = pendingReads.back();
+            pendingReads.pop_back();
+            read.job->runIORequest(read.type);
+        }
+
+        SfzLockFreeQueue<SfzIORequest> requests;
+        std::vector<SfzIORequest> pendingReads;
+    };
+    std::vector<std::unique_ptr<IOThread>> threads;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzIOQueue)
+};
@@ -0,0 +1,141 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+/**
+ * A bounded multi-producer multi-consumer queue (D. Vyukov's design).
+ * All the storage is allocated on construction; push() and pop() never
+ * allocate, never lock and fail instead of blocking when the queue is full
+ * or empty. The capacity is rounded up to the next power of 2.
+ */
+template<class T>
+class SfzLockFreeQueue
+{
+public:
+    SfzLockFreeQueue() = delete;
+    SfzLockFreeQueue(size_t minimumCapacity)
+    : capacity(roundToPowerOfTwo(minimumCapacity)), mask(capacity - 1), cells(new Cell[capacity])
+    {
+        for (size_t i = 0; i < capacity; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(T&& value) noexcept
+    {
+        Cell* cell;
+        auto position = writePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells[position & mask];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (difference == 0)
+            {
+                if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                position = writePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T& value) noexcept
+    {
+        T copy { value };
+        return push(std::move(copy));
+    }
+
+    bool pop(T& value) noexcept
+    {
+        Cell* cell;
+        auto position = readPosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells[position & mask];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (difference == 0)
+            {
+                if (readPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                position = readPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value);
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t getCapacity() const noexcept { return capacity; }
+
+    // Only an estimate if other threads are pushing or popping at the same time
+    size_t getNumReady() const noexcept
+    {
+        const auto written = writePosition.load(std::memory_order_relaxed);
+        const auto read = readPosition.load(std::memory_order_relaxed);
+        return written > read ? written - read : 0;
+    }
+
+    bool empty() const noexcept { return getNumReady() == 0; }
+private:
+    static size_t roundToPowerOfTwo(size_t value) noexcept
+    {
+        size_t powerOfTwo { 2 };
+        while (powerOfTwo < value)
+            powerOfTwo <<= 1;
+        return powerOfTwo;
+    }
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence { 0 };
+        T value {};
+    };
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    // Keep the producer and consumer positions on separate cache lines
+    alignas(64) std::atomic<size_t> writePosition { 0 };
+    alignas(64) std::atomic<size_t> readPosition { 0 };
+};
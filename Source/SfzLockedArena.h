@@ -0,0 +1,212 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#if JUCE_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <cerrno>
+#endif
+
+/**
+ * One large region of memory locked into RAM, from which the preloaded sample
+ * data is carved. The whole region is touched when it is created so that the
+ * audio thread never takes a page fault on it, even after the host has been
+ * idle under memory pressure. On Linux it can be backed by transparent huge
+ * pages, which also spares the TLB.
+ *
+ * Allocations are first fit over a free list and can come from any thread
+ * but the audio thread; they are released when the last buffer using them is.
+ * If the region cannot be created or locked, isValid() is false and
+ * getStatus() says why; the callers then fall back on the regular heap.
+ */
+class SfzLockedArena
+{
+public:
+    SfzLockedArena(size_t sizeInBytes, bool useHugePages)
+    {
+        const size_t granularity = useHugePages ? config::hugePageSize : config::lockedMemoryAlignment;
+        size = (sizeInBytes + granularity - 1) / granularity * granularity;
+        if (size == 0)
+        {
+            status = "empty arena";
+            return;
+        }
+
+#if JUCE_WINDOWS
+        region = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (region == nullptr)
+        {
+            status = "could not allocate " + String(static_cast<int64>(size)) + " bytes";
+            return;
+        }
+        prefault();
+        if (!VirtualLock(region, size))
+        {
+            // The working set quota is low by default; try raising it once
+            SIZE_T minimumSize, maximumSize;
+            const auto process = GetCurrentProcess();
+            if (!GetProcessWorkingSetSize(process, &minimumSize, &maximumSize)
+                || !SetProcessWorkingSetSize(process, minimumSize + size, maximumSize + size)
+                || !VirtualLock(region, size))
+            {
+                status = "could not lock the memory (error " + String(static_cast<int>(GetLastError())) + ")";
+                VirtualFree(region, 0, MEM_RELEASE);
+                region = nullptr;
+                return;
+            }
+        }
+#else
+        region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            region = nullptr;
+            status = "could not map " + String(static_cast<int64>(size)) + " bytes: " + String(std::strerror(errno));
+            return;
+        }
+    #if JUCE_LINUX && defined(MADV_HUGEPAGE)
+        // Only advisory: the kernel may not have huge pages to give
+        if (useHugePages)
+            hugePages = madvise(region, size, MADV_HUGEPAGE) == 0;
+    #endif
+        prefault();
+        if (mlock(region, size) != 0)
+        {
+            status = "could not lock the memory: " + String(std::strerror(errno)) + " (check the memlock limit)";
+            munmap(region, size);
+            region = nullptr;
+            return;
+        }
+#endif
+        freeBlocks[0] = size;
+        status = "locked " + String(static_cast<int64>(size)) + " bytes" + (hugePages ? " with huge pages" : "");
+    }
+
+    ~SfzLockedArena()
+    {
+        if (region == nullptr)
+            return;
+
+        // Everything carved from the arena must have been given back
+        jassert(used == 0);
+#if JUCE_WINDOWS
+        VirtualUnlock(region, size);
+        VirtualFree(region, 0, MEM_RELEASE);
+#else
+        munlock(region, size);
+        munmap(region, size);
+#endif
+    }
+
+    bool isValid() const noexcept { return region != nullptr; }
+    bool usesHugePages() const noexcept { return hugePages; }
+    const String& getStatus() const noexcept { return status; }
+    size_t getSize() const noexcept { return region != nullptr ? size : 0; }
+    size_t getUsedSize() const
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        return used;
+    }
+
+    /**
+     * Carve a block out of the arena; returns nullptr if there is no room left.
+     */
+    void* allocate(size_t numBytes)
+    {
+        numBytes = jmax(getAlignedSize(numBytes), config::lockedMemoryAlignment);
+        std::lock_guard<std::mutex> lock { mutex };
+        for (auto block = freeBlocks.begin(); block != freeBlocks.end(); ++block)
+        {
+            if (block->second < numBytes)
+                continue;
+
+            const auto offset = block->first;
+            const auto remaining = block->second - numBytes;
+            freeBlocks.erase(block);
+            if (remaining > 0)
+                freeBlocks[offset + numBytes] = remaining;
+
+            used += numBytes;
+            return static_cast<char*>(region) + offset;
+        }
+        return nullptr;
+    }
+
+    void release(void* data, size_t numBytes)
+    {
+        if (data == nullptr)
+            return;
+
+        numBytes = jmax(getAlignedSize(numBytes), config::lockedMemoryAlignment);
+        auto offset = static_cast<size_t>(static_cast<char*>(data) - static_cast<char*>(region));
+        jassert(offset + numBytes <= size);
+
+        std::lock_guard<std::mutex> lock { mutex };
+        used -= numBytes;
+
+        // Merge with the free blocks on both sides
+        auto next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.end() && offset + numBytes == next->first)
+        {
+            numBytes += next->second;
+            next = freeBlocks.erase(next);
+        }
+        if (next != freeBlocks.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                numBytes += previous->second;
+                freeBlocks.erase(previous);
+            }
+        }
+        freeBlocks[offset] = numBytes;
+    }
+private:
+    static size_t getAlignedSize(size_t numBytes) noexcept
+    {
+        return (numBytes + config::lockedMemoryAlignment - 1) / config::lockedMemoryAlignment * config::lockedMemoryAlignment;
+    }
+
+    void prefault() noexcept
+    {
+        // Write to every page so that they are all backed, and writable, before locking them
+        std::memset(region, 0, size);
+    }
+
+    void* region { nullptr };
+    size_t size { 0 };
+    size_t used { 0 };
+    bool hugePages { false };
+    String status;
+    mutable std::mutex mutex;
+    std::map<size_t, size_t> freeBlocks; // offset -> size
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzLockedArena)
+};
@@ -0,0 +1,174 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+enum class SfzMemoryCategory { preload, streaming };
+
+/**
+ * Keeps track of the sample memory of all the synths in the process and
+ * enforces an optional limit on it.
+ *
+ * The file pools report what they allocate and free, which is cheap and
+ * lock-free. When the usage goes over the limit, enforce() asks the pools for
+ * the memory they could give back, ranks it by priority across all of them
+ * and reclaims the least useful first until the usage is back under the
+ * limit, minus some hysteresis so that this does not run on every preload.
+ * Only the preloaded data can be reclaimed: the streaming buffers are sized
+ * by the voice count and the block size.
+ */
+class SfzMemoryBudget
+{
+public:
+    struct EvictionCandidate;
+
+    /**
+     * Something holding sample memory that can be reclaimed, i.e. a file pool.
+     */
+    class Client
+    {
+    public:
+        virtual ~Client() = default;
+        virtual void addEvictionCandidates(std::vector<EvictionCandidate>& candidates) = 0;
+        // Returns the number of bytes actually freed
+        virtual int64 evict(int candidateId) = 0;
+    };
+
+    struct EvictionCandidate
+    {
+        Client* client { nullptr };
+        int id { 0 };
+        float priority { 0.0f }; // Lower is evicted first
+        int64 reclaimableBytes { 0 };
+    };
+
+    SfzMemoryBudget() = default;
+
+    // The budget shared by all the synths of the process
+    static SfzMemoryBudget& getInstance()
+    {
+        static SfzMemoryBudget instance;
+        return instance;
+    }
+
+    /**
+     * Set the limit in bytes; 0 means no limit. This does not reclaim anything
+     * by itself: call enforce() from a background thread afterwards.
+     */
+    void setLimit(int64 bytes) noexcept { limit = jmax(bytes, int64 { 0 }); }
+    int64 getLimit() const noexcept { return limit; }
+
+    void allocate(SfzMemoryCategory category, int64 bytes) noexcept
+    {
+        usage[static_cast<size_t>(category)] += bytes;
+    }
+
+    void release(SfzMemoryCategory category, int64 bytes) noexcept
+    {
+        usage[static_cast<size_t>(category)] -= bytes;
+        jassert(usage[static_cast<size_t>(category)] >= 0);
+    }
+
+    int64 getUsage(SfzMemoryCategory category) const noexcept { return usage[static_cast<size_t>(category)]; }
+    int64 getUsage() const noexcept
+    {
+        int64 total { 0 };
+        for (const auto& categoryUsage: usage)
+            total += categoryUsage;
+        return total;
+    }
+
+    // Bytes left before the limit, or -1 without a limit
+    int64 getHeadroom() const noexcept
+    {
+        const int64 currentLimit = limit;
+        if (currentLimit == 0)
+            return -1;
+
+        return jmax(currentLimit - getUsage(), int64 { 0 });
+    }
+
+    bool isOverLimit() const noexcept
+    {
+        const int64 currentLimit = limit;
+        return currentLimit > 0 && getUsage() > currentLimit;
+    }
+
+    void addClient(Client* client)
+    {
+        std::lock_guard<std::mutex> lock { clientMutex };
+        clients.push_back(client);
+    }
+
+    void removeClient(Client* client)
+    {
+        std::lock_guard<std::mutex> lock { clientMutex };
+        clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+    }
+
+    /**
+     * Reclaim memory if the usage is over the limit. This can free large
+     * buffers: do not call it from the audio thread. Returns false if the
+     * usage is still over the limit, i.e. there was not enough to reclaim.
+     */
+    bool enforce()
+    {
+        if (!isOverLimit())
+            return true;
+
+        std::lock_guard<std::mutex> lock { clientMutex };
+        std::vector<EvictionCandidate> candidates;
+        for (auto* client: clients)
+            client->addEvictionCandidates(candidates);
+
+        std::sort(candidates.begin(), candidates.end(), [](const auto& lhs, const auto& rhs) {
+            if (lhs.priority != rhs.priority)
+                return lhs.priority < rhs.priority;
+            return lhs.reclaimableBytes > rhs.reclaimableBytes;
+        });
+
+        // The progress is counted from what the clients report as freed, since the usage
+        // also moves with the allocations of the other threads and the shrunk copies
+        const auto target = static_cast<int64>(static_cast<double>(limit) * config::memoryBudgetHysteresis);
+        auto remaining = getUsage() - target;
+        for (const auto& candidate: candidates)
+        {
+            if (remaining <= 0)
+                break;
+            remaining -= candidate.client->evict(candidate.id);
+        }
+
+        return !isOverLimit();
+    }
+private:
+    std::atomic<int64> limit { 0 };
+    std::array<std::atomic<int64>, 2> usage {};
+    std::mutex clientMutex;
+    std::vector<Client*> clients;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzMemoryBudget)
+};
@@ -0,0 +1,209 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <map>
+#include <optional>
+
+/**
+ * What the regions need to know about a sample file.
+ */
+struct SfzSampleInfo
+{
+    double sampleRate { config::defaultSampleRate };
+    int numChannels { 1 };
+    int64 lengthInSamples { 0 };
+    std::optional<Range<uint32_t>> loopRange;
+
+    static SfzSampleInfo fromReader(const AudioFormatReader& reader)
+    {
+        SfzSampleInfo info;
+        info.sampleRate = reader.sampleRate;
+        info.numChannels = static_cast<int>(reader.numChannels);
+        info.lengthInSamples = reader.lengthInSamples;
+        if (reader.metadataValues.containsKey("Loop0Start") && reader.metadataValues.containsKey("Loop0End"))
+        {
+            info.loopRange = Range<uint32_t>(static_cast<uint32_t>(reader.metadataValues["Loop0Start"].getLargeIntValue()),
+                                             static_cast<uint32_t>(reader.metadataValues["Loop0End"].getLargeIntValue()));
+        }
+        return info;
+    }
+
+    // Size of the data written by writeTo(), in bytes
+    static constexpr int64 serializedSize { 8 + 4 + 8 + 8 + 8 };
+
+    void writeTo(OutputStream& stream) const
+    {
+        stream.writeDouble(sampleRate);
+        stream.writeInt(numChannels);
+        stream.writeInt64(lengthInSamples);
+        stream.writeInt64(loopRange ? static_cast<int64>(loopRange->getStart()) : -1);
+        stream.writeInt64(loopRange ? static_cast<int64>(loopRange->getEnd()) : -1);
+    }
+
+    static SfzSampleInfo readFrom(InputStream& stream)
+    {
+        SfzSampleInfo info;
+        info.sampleRate = stream.readDouble();
+        info.numChannels = stream.readInt();
+        info.lengthInSamples = stream.readInt64();
+        const auto loopStart = stream.readInt64();
+        const auto loopEnd = stream.readInt64();
+        if (loopStart >= 0 && loopEnd >= 0)
+            info.loopRange = Range<uint32_t>(static_cast<uint32_t>(loopStart), static_cast<uint32_t>(loopEnd));
+        return info;
+    }
+};
+
+/**
+ * Sample information kept between sessions, so that loading an instrument
+ * again does not have to open and parse every sample header. The entries are
+ * keyed by the canonical path of the sample and checked against its
+ * modification time; a sample that changed on disk is probed again.
+ *
+ * The table lives in memory and is written back by save(), typically once an
+ * instrument is loaded. It is not thread-safe: use it from the loading thread.
+ */
+class SfzMetadataCache
+{
+public:
+    SfzMetadataCache() = default;
+    SfzMetadataCache(const File& cacheFile)
+    {
+        setFile(cacheFile);
+    }
+
+    /**
+     * Save the current table if needed and switch to another file. A null
+     * File keeps the table in memory only.
+     */
+    void setFile(const File& cacheFile)
+    {
+        save();
+        file = cacheFile;
+        entries.clear();
+        load();
+    }
+
+    std::optional<SfzSampleInfo> find(const File& sampleFile) const
+    {
+        const auto entry = entries.find(getKey(sampleFile));
+        if (entry == entries.end() || entry->second.modificationTime != sampleFile.getLastModificationTime().toMilliseconds())
+            return {};
+
+        return entry->second.info;
+    }
+
+    void store(const File& sampleFile, const SfzSampleInfo& info)
+    {
+        if (entries.size() >= config::metadataCacheMaxEntries)
+            entries.clear();
+
+        entries[getKey(sampleFile)] = { sampleFile.getLastModificationTime().toMilliseconds(), info };
+        dirty = true;
+    }
+
+    /**
+     * Write the table back if it changed. Returns false if it could not be written.
+     */
+    bool save()
+    {
+        if (!dirty || file.getFullPathName().isEmpty())
+            return true;
+
+        // Write aside and move in place, so that a concurrent session never reads a partial table;
+        // the temporary file has a unique name, so sessions saving at the same time do not write over each other
+        file.getParentDirectory().createDirectory();
+        TemporaryFile temporaryFile { file };
+        {
+            FileOutputStream stream { temporaryFile.getFile() };
+            if (!stream.openedOk())
+                return false;
+
+            stream.writeInt(config::metadataCacheMagic);
+            stream.writeInt(config::metadataCacheVersion);
+            stream.writeInt(static_cast<int>(entries.size()));
+            for (const auto& entry: entries)
+            {
+                stream.writeString(entry.first);
+                stream.writeInt64(entry.second.modificationTime);
+                entry.second.info.writeTo(stream);
+            }
+            stream.flush();
+            if (!stream.getStatus().wasOk())
+                return false;
+        }
+
+        if (!temporaryFile.overwriteTargetFileWithTemporary())
+            return false;
+
+        dirty = false;
+        return true;
+    }
+
+    File getFile() const { return file; }
+    int getNumEntries() const noexcept { return static_cast<int>(entries.size()); }
+private:
+    struct Entry
+    {
+        int64 modificationTime { 0 };
+        SfzSampleInfo info;
+    };
+    static constexpr int64 entrySize { 8 + SfzSampleInfo::serializedSize }; // after the key
+
+    static String getKey(const File& sampleFile)
+    {
+        // getChildFile() already resolves the . and .. parts; this resolves a symbolic link on the sample itself
+        return sampleFile.getLinkedTarget().getFullPathName();
+    }
+
+    void load()
+    {
+        dirty = false;
+        if (!file.existsAsFile())
+            return;
+
+        FileInputStream stream { file };
+        if (!stream.openedOk() || stream.readInt() != config::metadataCacheMagic || stream.readInt() != config::metadataCacheVersion)
+            return;
+
+        const auto numEntries = stream.readInt();
+        for (int entryIdx = 0; entryIdx < numEntries && !stream.isExhausted(); ++entryIdx)
+        {
+            // The reads past the end return zeros: a truncated entry would look valid
+            const auto key = stream.readString();
+            if (stream.getNumBytesRemaining() < entrySize)
+                break;
+
+            Entry entry;
+            entry.modificationTime = stream.readInt64();
+            entry.info = SfzSampleInfo::readFrom(stream);
+            entries[key] = entry;
+        }
+    }
+
+    File file;
+    std::map<String, Entry> entries;
+    bool dirty { false };
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzMetadataCache)
+};
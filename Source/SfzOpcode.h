@@ -23,6 +23,10 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "SfzGlobals.h"
 #include "JuceHelpers.h"
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
 #include <regex>
 #include <string>
 #include <optional>
@@ -34,39 +38,28 @@ struct SfzOpcode
     SfzOpcode(std::string_view inputOpcode, std::string_view inputValue)
     :opcode(inputOpcode), value(inputValue)
     {
-        if (const auto lastCharIndex = inputOpcode.find_last_not_of("1234567890"); lastCharIndex != inputOpcode.npos)
+        trimView(value);
+        trimView(opcode);
+        if (const auto lastCharIndex = opcode.find_last_not_of("1234567890"); lastCharIndex != opcode.npos && lastCharIndex + 1 < opcode.size())
         {
-            try
-            {
-                const auto firstNumIndex = lastCharIndex + 1;
-                const auto numberLength = inputOpcode.size() - firstNumIndex;
-                std::string parameterNum(inputOpcode.substr(firstNumIndex, numberLength));
-                parameter = static_cast<uint8_t>(std::stoi(parameterNum));
-                opcode = std::string_view(inputOpcode.data(), firstNumIndex);
-            }
-            catch (const std::exception& e [[maybe_unused]])
+            const auto firstNumIndex = lastCharIndex + 1;
+            uint16_t parameterNum { 0 };
+            const auto [ptr, errorCode] = std::from_chars(opcode.data() + firstNumIndex, opcode.data() + opcode.size(), parameterNum);
+            if (errorCode == std::errc())
             {
-                parameter = {};
+                parameter = parameterNum;
+                opcode.remove_suffix(opcode.size() - firstNumIndex);
             }
-            // Sketchy support for charconv in current versions of XCode, GCC, etc...
-            // TODO: It would be better than std::stoXX though, since we would not require a temporary string
-            // to be created. One can hope that such a string is small enough..
-            //
-            // int returnValue { 0 };
-            // auto [ptr, errorCode] = std::from_chars(lastCharPtr + 1, inputOpcode.data() + inputOpcode.size(), returnValue);
-
-            // if (errorCode == std::errc())
-            //     parameter = returnValue;
-            // opcode = std::string_view(inputOpcode.data(), std::distance(inputOpcode.data(), lastCharPtr + 1)  );
         }
-        trimView(value);
-        trimView(opcode);
+        opcodeHash = hash(opcode);
     }
 
     std::string_view opcode{};
-    std::string_view value{};	
+    std::string_view value{};
     // This is to handle the integer parameter of some opcodes
-    std::optional<uint8_t> parameter;
+    std::optional<uint16_t> parameter;
+    // Computed once here rather than each time the opcode is applied to a region
+    unsigned int opcodeHash { Fnv1aBasis };
 };
 
 inline std::optional<uint8_t> readNoteValue(const std::string_view&value)
@@ -218,58 +211,47 @@ inline std::optional<uint8_t> readNoteValue(const std::string_view&value)
 template<class ValueType>
 inline std::optional<ValueType> readOpcode(std::string_view value, const Range<ValueType>& validRange)
 {
+    // Unlike std::stoll and std::stof, std::from_chars does not accept a leading plus sign
+    if (!value.empty() && value.front() == '+')
+        value.remove_prefix(1);
+
     if constexpr(std::is_integral<ValueType>::value)
     {
-        // Sketchy support for charconv in current versions of XCode, GCC, etc...
-        // TODO: It would be better than std::stoXX though, since we would not require a temporary string
-        // to be created. One can hope that such a string is small enough..
-        //
-        // int64_t returnedValue;
-        // auto [ptr, errorCode] = std::from_chars(value.data(), value.data() + value.size(), returnedValue);
-        // if (errorCode != std::errc())
-        //     return {};
-
-        // if (returnedValue > std::numeric_limits<ValueType>::max())
-        //     returnedValue = std::numeric_limits<ValueType>::max();
-        // if (returnedValue < std::numeric_limits<ValueType>::min())
-        //     returnedValue = std::numeric_limits<ValueType>::min();
+        int64_t returnedValue { 0 };
+        const auto [ptr, errorCode] = std::from_chars(value.data(), value.data() + value.size(), returnedValue);
+        if (errorCode != std::errc())
+            return {};
 
-        // return validRange.clipValue(static_cast<ValueType>(returnedValue));
-        try
-        {
-            std::string valueStr { value };
-            auto returnedValue = std::stoll(valueStr);
-            
-            if (returnedValue > std::numeric_limits<ValueType>::max())
-                returnedValue = std::numeric_limits<ValueType>::max();
-            if (returnedValue < std::numeric_limits<ValueType>::min())
-                returnedValue = std::numeric_limits<ValueType>::min();
+        if (returnedValue > std::numeric_limits<ValueType>::max())
+            returnedValue = std::numeric_limits<ValueType>::max();
+        if (returnedValue < std::numeric_limits<ValueType>::min())
+            returnedValue = std::numeric_limits<ValueType>::min();
 
-            return validRange.clipValue(static_cast<ValueType>(returnedValue));
-        }
-        catch (const std::exception& e [[maybe_unused]])
-        {
-            return {};
-        }
+        return validRange.clipValue(static_cast<ValueType>(returnedValue));
     }
     else
     {
-        // GCC does not support this as of 8.3
-        // float returnedValue;
-        // auto [ptr, errorCode] = std::from_chars(value.data(), value.data() + value.size(), returnedValue);
-        // if (errorCode != std::errc())
-        //     return {};
+#if defined(__cpp_lib_to_chars)
+        float returnedValue { 0.0f };
+        const auto [ptr, errorCode] = std::from_chars(value.data(), value.data() + value.size(), returnedValue);
+        if (errorCode != std::errc())
+            return {};
+#else
+        // No floating point std::from_chars in this standard library (GCC before 11);
+        // strtof needs a null-terminated string, which is copied on the stack
+        std::array<char, 64> buffer;
+        if (value.empty() || value.size() >= buffer.size())
+            return {};
+        std::copy(value.begin(), value.end(), buffer.begin());
+        buffer[value.size()] = '\0';
 
-        // return validRange.clipValue(returnedValue);
-        try
-        {
-            std::string valueStr { value };
-            return validRange.clipValue(std::stof(valueStr));
-        }
-        catch (const std::exception& e [[maybe_unused]])
-        {
+        char* end { nullptr };
+        errno = 0;
+        const auto returnedValue = std::strtof(buffer.data(), &end);
+        if (end == buffer.data() || errno == ERANGE)
             return {};
-        }
+#endif
+        return validRange.clipValue(returnedValue);
     }
 }
 
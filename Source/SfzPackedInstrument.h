@@ -0,0 +1,243 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include "SfzMetadataCache.h"
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if JUCE_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * An instrument packed in a single file: the preprocessed sfz text, the
+ * information on each sample and the samples themselves as wav files,
+ * aligned so that they can be mapped or read directly.
+ *
+ * Layout (little endian):
+ *  - header: magic, version, offset and size of the sfz text, offset of the index, number of samples
+ *  - the sfz text, with the includes and defines already resolved
+ *  - the wav files, each starting on a packAlignment boundary
+ *  - the index: for each sample, its name in the sfz text, offset and size in
+ *    the pack, sample rate, channels, length and loop points (-1 if none)
+ *
+ * Opening a pack is a single open and mapping; nothing else touches the disk
+ * until the samples are read.
+ */
+class SfzPackedInstrument
+{
+public:
+    struct Entry
+    {
+        int64 offset { 0 };
+        int64 size { 0 };
+        SfzSampleInfo info;
+    };
+
+    SfzPackedInstrument(const File& packFile)
+    : file(packFile)
+    {
+        mappedFile = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+        if (mappedFile->getData() == nullptr || !parse())
+        {
+            DBG("Could not read the packed instrument " << file.getFullPathName());
+            mappedFile.reset();
+            entries.clear();
+            return;
+        }
+#if JUCE_LINUX
+        fileDescriptor = ::open(file.getFullPathName().toRawUTF8(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+
+    ~SfzPackedInstrument()
+    {
+#if JUCE_LINUX
+        if (fileDescriptor >= 0)
+            ::close(fileDescriptor);
+#endif
+    }
+
+    static bool isPackedInstrument(const File& file)
+    {
+        return file.hasFileExtension(config::packedInstrumentExtension);
+    }
+
+    bool isValid() const noexcept { return mappedFile != nullptr; }
+    const File& getFile() const noexcept { return file; }
+    // An open descriptor on the pack for the readers that don't work from the mapping, or -1
+    int getFileDescriptor() const noexcept { return fileDescriptor; }
+    const std::string& getSfzText() const noexcept { return sfzText; }
+    int getNumSamples() const noexcept { return static_cast<int>(entries.size()); }
+
+    const Entry* getEntry(const String& sampleName) const
+    {
+        const auto entry = entries.find(sampleName);
+        if (entry == entries.end())
+            return nullptr;
+        return &entry->second;
+    }
+
+    /**
+     * A reader on a packed sample, reading straight from the mapped pack.
+     */
+    std::unique_ptr<AudioFormatReader> createReaderFor(const String& sampleName) const
+    {
+        const auto* entry = getEntry(sampleName);
+        if (entry == nullptr)
+            return {};
+
+        const auto* data = static_cast<const char*>(mappedFile->getData()) + entry->offset;
+        WavAudioFormat wavFormat;
+        return std::unique_ptr<AudioFormatReader>(wavFormat.createReaderFor(new MemoryInputStream(data, static_cast<size_t>(entry->size), false), true));
+    }
+
+    /**
+     * Write a pack from the preprocessed sfz text and the sample files, given
+     * with their names in the text. Wav files are copied as they are; other
+     * formats are decoded to 32 bits float wav files.
+     */
+    static bool pack(const std::string& sfzText, const std::vector<std::pair<String, File>>& samples, const File& output, AudioFormatManager& formatManager)
+    {
+        output.deleteFile();
+        FileOutputStream stream { output };
+        if (!stream.openedOk())
+            return false;
+
+        // The header is written again at the end, once the offsets are known
+        writeHeader(stream, 0, 0, 0, 0);
+        const auto sfzOffset = stream.getPosition();
+        stream.write(sfzText.data(), sfzText.size());
+
+        std::vector<std::pair<String, Entry>> packedEntries;
+        for (const auto& sample: samples)
+        {
+            std::unique_ptr<AudioFormatReader> reader { formatManager.createReaderFor(sample.second) };
+            if (reader == nullptr)
+            {
+                DBG("Could not pack " << sample.second.getFullPathName());
+                return false;
+            }
+
+            Entry entry;
+            entry.info = SfzSampleInfo::fromReader(*reader);
+            const auto padding = (config::packAlignment - stream.getPosition() % config::packAlignment) % config::packAlignment;
+            stream.writeRepeatedByte(0, static_cast<size_t>(padding));
+            entry.offset = stream.getPosition();
+
+            if (sample.second.hasFileExtension("wav"))
+            {
+                FileInputStream input { sample.second };
+                if (!input.openedOk() || stream.writeFromInputStream(input, -1) != input.getTotalLength())
+                    return false;
+            }
+            else
+            {
+                MemoryBlock decoded;
+                {
+                    WavAudioFormat wavFormat;
+                    std::unique_ptr<AudioFormatWriter> writer { wavFormat.createWriterFor(new MemoryOutputStream(decoded, false), reader->sampleRate, reader->numChannels, 32, reader->metadataValues, 0) };
+                    if (writer == nullptr || !writer->writeFromAudioReader(*reader, 0, -1))
+                        return false;
+                }
+                stream.write(decoded.getData(), decoded.getSize());
+            }
+
+            entry.size = stream.getPosition() - entry.offset;
+            packedEntries.emplace_back(sample.first, entry);
+        }
+
+        const auto indexOffset = stream.getPosition();
+        for (const auto& packedEntry: packedEntries)
+        {
+            const auto& entry = packedEntry.second;
+            stream.writeString(packedEntry.first);
+            stream.writeInt64(entry.offset);
+            stream.writeInt64(entry.size);
+            entry.info.writeTo(stream);
+        }
+
+        if (!stream.setPosition(0))
+            return false;
+        writeHeader(stream, sfzOffset, static_cast<int64>(sfzText.size()), indexOffset, static_cast<int>(packedEntries.size()));
+        stream.flush();
+        return stream.getStatus().wasOk();
+    }
+private:
+    static void writeHeader(OutputStream& stream, int64 sfzOffset, int64 sfzSize, int64 indexOffset, int numSamples)
+    {
+        stream.writeInt(config::packMagic);
+        stream.writeInt(config::packVersion);
+        stream.writeInt64(sfzOffset);
+        stream.writeInt64(sfzSize);
+        stream.writeInt64(indexOffset);
+        stream.writeInt(numSamples);
+    }
+
+    bool parse()
+    {
+        const auto size = static_cast<int64>(mappedFile->getSize());
+        MemoryInputStream stream { mappedFile->getData(), mappedFile->getSize(), false };
+        if (stream.readInt() != config::packMagic || stream.readInt() != config::packVersion)
+            return false;
+
+        const auto sfzOffset = stream.readInt64();
+        const auto sfzSize = stream.readInt64();
+        const auto indexOffset = stream.readInt64();
+        const auto numSamples = stream.readInt();
+        if (sfzOffset < 0 || sfzSize < 0 || sfzOffset + sfzSize > size || indexOffset < 0 || indexOffset > size || numSamples < 0)
+            return false;
+
+        sfzText.assign(static_cast<const char*>(mappedFile->getData()) + sfzOffset, static_cast<size_t>(sfzSize));
+
+        stream.setPosition(indexOffset);
+        for (int sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
+        {
+            if (stream.isExhausted())
+                return false;
+
+            const auto sampleName = stream.readString();
+            Entry entry;
+            entry.offset = stream.readInt64();
+            entry.size = stream.readInt64();
+            entry.info = SfzSampleInfo::readFrom(stream);
+
+            if (entry.offset < 0 || entry.size < 0 || entry.offset + entry.size > size)
+                return false;
+            entries[sampleName] = entry;
+        }
+        return true;
+    }
+
+    File file;
+    std::unique_ptr<MemoryMappedFile> mappedFile;
+    int fileDescriptor { -1 };
+    std::string sfzText;
+    std::map<String, Entry> entries;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzPackedInstrument)
+};
@@ -0,0 +1,290 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Expands the #include and #define directives of an sfz file into a single
+ * string, with the comments and empty lines removed and the remaining lines
+ * separated by a space.
+ *
+ * Each file is memory-mapped and cut into lines once. Include paths do not
+ * depend on the defines, so the include tree is discovered and read on a
+ * thread pool; the expansion then walks it in order on the calling thread,
+ * since a define applies to everything that comes after it. Defined
+ * variables are looked up in a hash table and the longest defined name wins,
+ * so that $KEY and $KEYSWITCH can both be used.
+ *
+ * A file is included once, the first time it appears.
+ */
+class SfzPreprocessor
+{
+public:
+    SfzPreprocessor(const std::filesystem::path& rootDirectory, int numThreads = config::numLoadingThreads)
+    : rootDirectory(rootDirectory), numThreads(numThreads)
+    {
+
+    }
+
+    std::string process(const std::filesystem::path& file)
+    {
+        sources.clear();
+        includedFiles.clear();
+        includedKeys.clear();
+        defines.clear();
+        maxDefineLength = 0;
+
+        // Read the whole include tree
+        sources.emplace(file.string(), nullptr);
+        pendingReads = 1;
+        read(file);
+        if (--pendingReads > 0)
+            readsDone.wait();
+        threadPool.reset();
+
+        const auto root = sources.find(file.string());
+        if (root == sources.end() || root->second == nullptr)
+            return {};
+
+        size_t totalSize { 0 };
+        for (const auto& source: sources)
+            totalSize += source.second != nullptr ? source.second->size : 0;
+
+        std::string output;
+        output.reserve(totalSize);
+        expand(*root->second, output);
+        return output;
+    }
+
+    const std::vector<std::filesystem::path>& getIncludedFiles() const noexcept { return includedFiles; }
+
+    // The defines in effect at the end of the expansion
+    std::map<std::string, std::string> getDefines() const
+    {
+        std::map<std::string, std::string> returnValue;
+        for (const auto& define: defines)
+            returnValue.emplace(define.first, define.second);
+        return returnValue;
+    }
+private:
+    struct Line
+    {
+        enum class Kind { text, include, define };
+        Kind kind { Kind::text };
+        std::string_view text {}; // the line, or the name of the define
+        std::string_view value {}; // the value of the define
+        std::filesystem::path includePath {};
+    };
+
+    struct Source
+    {
+        std::unique_ptr<MemoryMappedFile> mappedFile;
+        size_t size { 0 };
+        std::vector<Line> lines;
+    };
+
+    using svmatch_results = std::match_results<std::string_view::const_iterator>;
+
+    std::unique_ptr<Source> readSource(const std::filesystem::path& path) const
+    {
+        const auto file = File::getCurrentWorkingDirectory().getChildFile(path.string());
+        if (!file.existsAsFile())
+            return {};
+
+        auto source = std::make_unique<Source>();
+        if (file.getSize() == 0)
+            return source;
+
+        source->mappedFile = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+        if (source->mappedFile->getData() == nullptr)
+        {
+            DBG("Could not map " << file.getFullPathName());
+            return source;
+        }
+
+        source->size = source->mappedFile->getSize();
+        const std::string_view contents { static_cast<const char*>(source->mappedFile->getData()), source->size };
+        svmatch_results match;
+        size_t lineStart { 0 };
+        while (lineStart < contents.size())
+        {
+            auto lineEnd = contents.find('\n', lineStart);
+            if (lineEnd == contents.npos)
+                lineEnd = contents.size();
+
+            auto line = contents.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+
+            if (const auto comment = line.find("//"); comment != line.npos)
+                line.remove_suffix(line.size() - comment);
+            trimView(line);
+            if (line.empty())
+                continue;
+
+            // The directives are rare; only run the regexes on the lines that may hold one
+            auto& parsed = source->lines.emplace_back();
+            parsed.text = line;
+            if (line.find("#include") != line.npos && std::regex_search(line.begin(), line.end(), match, SfzRegexes::includes))
+            {
+                auto includePath = match.str(1);
+                std::replace(includePath.begin(), includePath.end(), '\\', '/');
+                parsed.kind = Line::Kind::include;
+                parsed.includePath = rootDirectory / includePath;
+            }
+            else if (line.find("#define") != line.npos && std::regex_search(line.begin(), line.end(), match, SfzRegexes::defines))
+            {
+                parsed.kind = Line::Kind::define;
+                parsed.text = std::string_view(&*match[1].first, match.length(1));
+                parsed.value = std::string_view(&*match[2].first, match.length(2));
+            }
+        }
+        return source;
+    }
+
+    void read(const std::filesystem::path& path)
+    {
+        auto source = readSource(path);
+
+        std::lock_guard<std::mutex> lock { sourcesMutex };
+        if (source != nullptr)
+        {
+            for (const auto& line: source->lines)
+            {
+                if (line.kind == Line::Kind::include && sources.emplace(line.includePath.string(), nullptr).second)
+                    scheduleRead(line.includePath);
+            }
+        }
+        sources[path.string()] = std::move(source);
+    }
+
+    // Called with the sources lock held
+    void scheduleRead(const std::filesystem::path& path)
+    {
+        if (threadPool == nullptr)
+            threadPool = std::make_unique<ThreadPool>(numThreads);
+
+        ++pendingReads;
+        threadPool->addJob([this, path] {
+            read(path);
+            if (--pendingReads == 0)
+                readsDone.signal();
+        });
+    }
+
+    void expand(const Source& source, std::string& output)
+    {
+        for (const auto& line: source.lines)
+        {
+            switch (line.kind)
+            {
+            case Line::Kind::include:
+            {
+                auto key = line.includePath.string();
+                const auto included = sources.find(key);
+                if (included != sources.end() && included->second != nullptr && includedKeys.insert(std::move(key)).second)
+                {
+                    includedFiles.push_back(line.includePath);
+                    expand(*included->second, output);
+                }
+                break;
+            }
+            case Line::Kind::define:
+                defines[line.text] = line.value;
+                maxDefineLength = std::max(maxDefineLength, line.text.length());
+                break;
+            case Line::Kind::text:
+                appendWithDefines(line.text, output);
+                output += ' ';
+                break;
+            }
+        }
+    }
+
+    static bool isDefineCharacter(char c) noexcept
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+    }
+
+    void appendWithDefines(std::string_view line, std::string& output) const
+    {
+        size_t lastPosition { 0 };
+        auto position = line.find(config::defineCharacter);
+        while (position != line.npos)
+        {
+            output.append(line.data() + lastPosition, position - lastPosition);
+            lastPosition = position;
+
+            auto nameEnd = position + 1;
+            while (nameEnd < line.size() && nameEnd - position < maxDefineLength && isDefineCharacter(line[nameEnd]))
+                ++nameEnd;
+
+            for (; nameEnd > position + 1; --nameEnd)
+            {
+                const auto define = defines.find(line.substr(position, nameEnd - position));
+                if (define != defines.end())
+                {
+                    output += define->second;
+                    lastPosition = nameEnd;
+                    break;
+                }
+            }
+
+            if (lastPosition == position)
+            {
+                output += config::defineCharacter;
+                lastPosition = position + 1;
+            }
+            position = line.find(config::defineCharacter, lastPosition);
+        }
+        output.append(line.data() + lastPosition, line.size() - lastPosition);
+    }
+
+    const std::filesystem::path rootDirectory;
+    const int numThreads;
+
+    std::mutex sourcesMutex;
+    std::unordered_map<std::string, std::unique_ptr<Source>> sources;
+    std::unique_ptr<ThreadPool> threadPool;
+    std::atomic<int> pendingReads { 0 };
+    WaitableEvent readsDone;
+
+    std::vector<std::filesystem::path> includedFiles;
+    std::unordered_set<std::string> includedKeys;
+    std::unordered_map<std::string_view, std::string_view> defines;
+    size_t maxDefineLength { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SfzPreprocessor)
+};
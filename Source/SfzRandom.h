@@ -0,0 +1,82 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+
+
+#pragma once
+#include <cstdint>
+
+/**
+ * Small and fast pseudo-random generator (xoshiro128+) for the audio thread.
+ *
+ * Each synth owns one, so the random opcodes (amp_random, pitch_random,
+ * offset_random, delay_random and the lorand/hirand selection) draw from a
+ * sequence that only depends on the seed and on the events the synth
+ * received; rendering the same events with the same seed gives the same
+ * output. The state is 16 bytes and is not shared between threads.
+ */
+class SfzRandom
+{
+public:
+    SfzRandom(uint64_t seed = 0) noexcept { setSeed(seed); }
+
+    void setSeed(uint64_t seed) noexcept
+    {
+        // Expand the seed with splitmix64, which never gives an all-zero state
+        for (int i = 0; i < 4; i += 2)
+        {
+            seed += 0x9e3779b97f4a7c15;
+            auto z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            z ^= z >> 31;
+            state[i] = static_cast<uint32_t>(z);
+            state[i + 1] = static_cast<uint32_t>(z >> 32);
+        }
+    }
+
+    uint32_t next() noexcept
+    {
+        const auto result = state[0] + state[3];
+        const auto t = state[1] << 9;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotateLeft(state[3], 11);
+        return result;
+    }
+
+    // Uniform in [0, 1); the upper bits of xoshiro128+ are the best ones
+    float nextFloat() noexcept { return static_cast<float>(next() >> 8) * 0x1.0p-24f; }
+
+    // Uniform in [0, maxValue), or 0 if maxValue is not positive
+    int nextInt(int maxValue) noexcept
+    {
+        if (maxValue <= 0)
+            return 0;
+        return static_cast<int>((static_cast<uint64_t>(next()) * static_cast<uint32_t>(maxValue)) >> 32);
+    }
+private:
+    static uint32_t rotateLeft(uint32_t x, int k) noexcept { return (x << k) | (x >> (32 - k)); }
+    uint32_t state[4];
+};
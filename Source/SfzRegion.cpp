@@ -24,17 +24,13 @@
 SfzRegion::SfzRegion(const File& root, SfzFilePool& filePool)
 : rootDirectory(root), filePool(filePool)
 {
-    for (auto& velocity : lastNoteVelocities)
-        velocity = 0;
-
-    for (auto& ccSwitch: ccSwitched)
-        ccSwitch = true;
+    ccSwitched.set();
 }
 
 void SfzRegion::parseOpcode(const SfzOpcode& opcode)
 {
     prepared = false; // region state changed
-    switch (hash(opcode.opcode))
+    switch (opcode.opcodeHash)
     {
     // Sound source: sample playback
     case hash("sample"): 
@@ -105,11 +101,11 @@ void SfzRegion::parseOpcode(const SfzOpcode& opcode)
     case hash("lobend"): setRangeStartFromOpcode(opcode, bendRange, SfzDefault::bendRange); break;
     case hash("hibend"): setRangeEndFromOpcode(opcode, bendRange, SfzDefault::bendRange); break;
     case hash("locc"): 
-        if (opcode.parameter) 
+        if (opcode.parameter && withinRange(SfzDefault::ccRange, *opcode.parameter))
             setRangeStartFromOpcode(opcode, ccConditions[*opcode.parameter], SfzDefault::ccRange); 
         break;
     case hash("hicc"):
-        if (opcode.parameter) 
+        if (opcode.parameter && withinRange(SfzDefault::ccRange, *opcode.parameter))
             setRangeEndFromOpcode(opcode, ccConditions[*opcode.parameter], SfzDefault::ccRange); 
         break;
     case hash("sw_lokey"): setRangeStartFromOpcode(opcode, keyswitchRange, SfzDefault::keyRange); break;
@@ -164,11 +160,11 @@ void SfzRegion::parseOpcode(const SfzOpcode& opcode)
         }
         break;
     case hash("on_locc"): 
-        if (opcode.parameter) 
+        if (opcode.parameter && withinRange(SfzDefault::ccRange, *opcode.parameter))
             setRangeStartFromOpcode(opcode, ccTriggers[*opcode.parameter], SfzDefault::ccRange); 
         break;
     case hash("on_hicc"):
-        if (opcode.parameter) 
+        if (opcode.parameter && withinRange(SfzDefault::ccRange, *opcode.parameter))
             setRangeEndFromOpcode(opcode, ccTriggers[*opcode.parameter], SfzDefault::ccRange); 
         break;
 
@@ -326,7 +322,7 @@ bool SfzRegion::registerNoteOn(int channel, int noteNumber, uint8_t velocity, fl
             sequenceSwitched = false;
 
         // Velocity memory for release_key and for sw_vel=previous
-        if (trigger == SfzTrigger::release_key || velocityOverride == SfzVelocityOverride::previous)
+        if (!lastNoteVelocities.empty())
             lastNoteVelocities[noteNumber] = velocity;
 
         if (previousNote)
@@ -438,34 +434,51 @@ void SfzRegion::registerTempo(float secondsPerQuarter)
         bpmSwitched = false;
 }
 
-bool SfzRegion::prepare()
+SfzSampleId SfzRegion::preloadSample()
+{
+    if (isGenerator())
+        return invalidSampleId;
+
+    // Until the sample is played, its share of the keyboard and velocity range says how likely it is to be
+    const auto keyShare = static_cast<float>(keyRange.getLength() + 1) / 128.0f;
+    const auto velocityShare = static_cast<float>(velocityRange.getLength() + 1) / 128.0f;
+    const auto priority = keyShare * velocityShare;
+
+    // A deferred preload runs on the articulation loader thread: prepare() registered the sample and
+    // looked up its information on the loading thread already, so only its data is read here
+    if (sampleId != invalidSampleId)
+        return filePool.preload(sampleId, offset + offsetRandom, config::preloadSize, priority);
+
+    return filePool.preload(sample, offset + offsetRandom, config::preloadSize, priority);
+}
+
+bool SfzRegion::prepare(bool deferPreload)
 {
     prepared = false;
 
     if (!isGenerator())
     {
-        filePool.preload(sample, offset + offsetRandom);
-        auto reader = filePool.createReaderFor(sample);
-        if (reader == nullptr)
+        sampleId = deferPreload ? filePool.registerSample(sample) : preloadSample();
+        // Share the storage of the path with the other regions playing this sample
+        if (sampleId != invalidSampleId)
+            sample = filePool.getSampleName(sampleId);
+        const auto sampleInfo = filePool.getSampleInfo(sample);
+        if (!sampleInfo)
         {
             DBG("[Prepare region] Error creating reader for " << sample);
             return false;
         }
 
-        sampleRate = reader->sampleRate;
+        sampleRate = sampleInfo->sampleRate;
         // The file is way too big to be "normal". A sample of 4 GB is a bit over the top, isn't it?
-        jassert(reader->lengthInSamples <= SfzDefault::sampleEndRange.getEnd());
+        jassert(sampleInfo->lengthInSamples <= SfzDefault::sampleEndRange.getEnd());
         
         if (sampleEnd == SfzDefault::sampleEndRange.getEnd())
-            sampleEnd = static_cast<uint32_t>(reader->lengthInSamples);
-        numChannels = reader->numChannels;
+            sampleEnd = static_cast<uint32_t>(sampleInfo->lengthInSamples);
+        numChannels = sampleInfo->numChannels;
 
-        if (reader->metadataValues.containsKey("Loop0Start") && reader->metadataValues.containsKey("Loop0End") && loopRange == SfzDefault::loopRange)
-        {
-            // DBG("Looping between " << reader->metadataValues["Loop0Start"] << " and " << reader->metadataValues["Loop0End"]);
-            loopRange.setStart(static_cast<uint32_t>(reader->metadataValues["Loop0Start"].getLargeIntValue()));
-            loopRange.setEnd(static_cast<uint32_t>(reader->metadataValues["Loop0End"].getLargeIntValue()));
-        }
+        if (sampleInfo->loopRange && loopRange == SfzDefault::loopRange)
+            loopRange = *sampleInfo->loopRange;
     }
 
     if (sampleCount)
@@ -474,13 +487,13 @@ bool SfzRegion::prepare()
     if (sampleEnd == 0 || sample == "")
         sample = "*silence";
 
-    if (trigger == SfzTrigger::release_key)
-    {
-        for (auto& vel: lastNoteVelocities)
-            vel = 0;
-    }
+    if (trigger == SfzTrigger::release_key || velocityOverride == SfzVelocityOverride::previous)
+        lastNoteVelocities.assign(128, 0);
+    else
+        lastNoteVelocities.clear();
 
     addEndpointsToVelocityCurve();
+    bakeNoteTables();
     checkInitialConditions();
     prepared = true;
     return true;
@@ -511,10 +524,10 @@ void SfzRegion::addEndpointsToVelocityCurve()
 void SfzRegion::checkInitialConditions()
 {
     
-    for (int ccIdx = 0; ccIdx < 128; ++ccIdx)
+    for (const auto& condition: ccConditions)
     {
-        if (ccConditions.getWithDefault(ccIdx).getStart() > 0)
-            ccSwitched[ccIdx] = false;
+        if (condition.second.getStart() > 0)
+            ccSwitched[condition.first] = false;
     }
 
     if (!bendRange.contains(SfzDefault::bend))
@@ -568,6 +581,95 @@ float SfzRegion::velocityGain(uint8_t velocity) const noexcept
     return Decibels::decibelsToGain(gaindB);
 }
 
+void SfzRegion::bakeNoteTables()
+{
+    keyCrossfadeGains.clear();
+    keyPitchRatios.clear();
+    for (int noteNumber = keyRange.getStart(); noteNumber <= keyRange.getEnd(); ++noteNumber)
+    {
+        keyCrossfadeGains.push_back(computeKeyCrossfadeGain(noteNumber));
+        keyPitchRatios.push_back(computeKeyPitchRatio(noteNumber));
+    }
+
+    velocityGains.clear();
+    velocityPitchRatios.clear();
+    for (int velocity = velocityRange.getStart(); velocity <= velocityRange.getEnd(); ++velocity)
+    {
+        velocityGains.push_back(computeVelocityGain(static_cast<uint8_t>(velocity)));
+        if (pitchVeltrack != 0)
+            velocityPitchRatios.push_back(computeVelocityPitchRatio(static_cast<uint8_t>(velocity)));
+    }
+}
+
+float SfzRegion::computeKeyCrossfadeGain(int noteNumber) const noexcept
+{
+    float gain { 1.0f };
+    if (noteNumber < crossfadeKeyInRange.getStart())
+        gain = 0.0f;
+    else if (noteNumber < crossfadeKeyInRange.getEnd())
+    {
+        const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeKeyInRange.getStart()) / crossfadeKeyInRange.getLength();
+        if (crossfadeKeyCurve == SfzCrossfadeCurve::power)
+            gain *= sqrt(crossfadePosition);
+        if (crossfadeKeyCurve == SfzCrossfadeCurve::gain)
+            gain *= crossfadePosition;
+    }
+
+    if (noteNumber > crossfadeKeyOutRange.getEnd())
+        gain = 0.0f;
+    else if (noteNumber > crossfadeKeyOutRange.getStart())
+    {
+        const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeKeyOutRange.getStart()) / crossfadeKeyOutRange.getLength();
+        if (crossfadeKeyCurve == SfzCrossfadeCurve::power)
+            gain *= sqrt(1 - crossfadePosition);
+        if (crossfadeKeyCurve == SfzCrossfadeCurve::gain)
+            gain *= 1 - crossfadePosition;
+    }
+
+    return gain;
+}
+
+float SfzRegion::computeKeyPitchRatio(int noteNumber) const noexcept
+{
+    auto pitchVariationInCents = pitchKeytrack * (noteNumber - (int)pitchKeycenter); // note difference with pitch center
+    pitchVariationInCents += tune; // sample tuning
+    pitchVariationInCents += config::centPerSemitone * transpose; // sample transpose
+    return centsFactor(pitchVariationInCents);
+}
+
+float SfzRegion::computeVelocityGain(uint8_t velocity) const noexcept
+{
+    float gain { velocityGain(velocity) };
+    if (velocity < crossfadeVelInRange.getStart())
+        gain = 0.0f;
+    else if (velocity < crossfadeVelInRange.getEnd())
+    {
+        const auto crossfadePosition = static_cast<float>(velocity - crossfadeVelInRange.getStart()) / crossfadeVelInRange.getLength();
+        if (crossfadeVelCurve == SfzCrossfadeCurve::power)
+            gain *= sqrt(crossfadePosition);
+        if (crossfadeVelCurve == SfzCrossfadeCurve::gain)
+            gain *= crossfadePosition;
+    }
+
+    if (velocity > crossfadeVelOutRange.getEnd())
+        gain = 0.0f;
+    else if (velocity > crossfadeVelOutRange.getStart())
+    {
+        const auto crossfadePosition = static_cast<float>(velocity - crossfadeVelOutRange.getStart()) / crossfadeVelOutRange.getLength();
+        if (crossfadeVelCurve == SfzCrossfadeCurve::power)
+            gain *= sqrt(1 - crossfadePosition);
+        if (crossfadeVelCurve == SfzCrossfadeCurve::gain)
+            gain *= 1 - crossfadePosition;
+    }
+
+    return gain;
+}
+
+float SfzRegion::computeVelocityPitchRatio(uint8_t velocity) const noexcept
+{
+    return centsFactor(normalizeCC(velocity) * pitchVeltrack); // track velocity
+}
+
 bool SfzRegion::isSwitchedOn() const noexcept
 {
     return  keySwitched 
@@ -576,5 +678,5 @@ bool SfzRegion::isSwitchedOn() const noexcept
             && pitchSwitched 
             && bpmSwitched 
             && aftertouchSwitched 
-            && std::all_of(ccSwitched.cbegin(), ccSwitched.cend(), [](auto& sw) { return sw; });
+            && ccSwitched.all();
 }
\ No newline at end of file
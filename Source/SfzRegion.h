@@ -27,10 +27,12 @@
 #include "SfzOpcode.h"
 #include "SfzEnvelope.h"
 #include "SfzFilePool.h"
+#include "SfzRandom.h"
 #include "JuceHelpers.h"
 #include <string>
 #include <optional>
 #include <array>
+#include <bitset>
 #include <map>
 
 struct SfzRegion
@@ -39,79 +41,37 @@ struct SfzRegion
     SfzRegion(const File& root, SfzFilePool& filePool);
     void parseOpcode(const SfzOpcode& opcode);
     String stringDescription() const noexcept;
-    bool prepare();
+    // With deferPreload the sample is registered but its data is left for preloadSample() to load later
+    bool prepare(bool deferPreload = false);
+    SfzSampleId preloadSample();
     bool isStereo() const noexcept;
     float velocityGain(uint8_t velocity) const noexcept;
-    float getBasePitchVariation(int noteNumber, uint8_t velocity) const noexcept
+    // The note-on computations below read the tables baked by prepare(), and only compute
+    // the values outside of the key and velocity ranges of the region (e.g. for release triggers)
+    float getBasePitchVariation(int noteNumber, uint8_t velocity, SfzRandom& random) const noexcept
     {
-        auto pitchVariationInCents = pitchKeytrack * (noteNumber - (int)pitchKeycenter); // note difference with pitch center
-        pitchVariationInCents += tune; // sample tuning
-        pitchVariationInCents += config::centPerSemitone * transpose; // sample transpose
-        pitchVariationInCents += velocity / 127 * pitchVeltrack; // track velocity
+        auto pitchRatio = lookup(keyPitchRatios, keyRange.getStart(), noteNumber, [&]() { return computeKeyPitchRatio(noteNumber); });
+        if (pitchVeltrack != 0)
+            pitchRatio *= lookup(velocityPitchRatios, velocityRange.getStart(), velocity, [&]() { return computeVelocityPitchRatio(velocity); });
         if (pitchRandom > 0)
-            pitchVariationInCents += Random::getSystemRandom().nextInt((int)pitchRandom * 2) - pitchRandom; // random pitch changes
-        return centsFactor(pitchVariationInCents);
+            pitchRatio *= centsFactor(random.nextInt((int)pitchRandom * 2) - pitchRandom); // random pitch changes
+        return pitchRatio;
     }
-    float getBaseGain() const noexcept
+    float getBaseGain(SfzRandom& random) const noexcept
     {
         float baseGaindB { volume };
-        baseGaindB += (2 * Random::getSystemRandom().nextFloat() - 1) * ampRandom;
+        baseGaindB += (2 * random.nextFloat() - 1) * ampRandom;
         return Decibels::decibelsToGain(baseGaindB);
     }
 
     float getNoteGain(int noteNumber, uint8_t velocity) const noexcept
     {
-        float baseGain { 1.0f };
-        if (trigger == SfzTrigger::release_key)
-            baseGain *= velocityGain(lastNoteVelocities[noteNumber]);
-        else
-            baseGain *= velocityGain(velocity);
-
-        if (noteNumber < crossfadeKeyInRange.getStart())
-            baseGain = 0.0f;
-        else if (noteNumber < crossfadeKeyInRange.getEnd())
-        {
-            const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeKeyInRange.getStart()) / crossfadeKeyInRange.getLength();
-            if (crossfadeKeyCurve == SfzCrossfadeCurve::power)
-                baseGain *= sqrt(crossfadePosition);
-            if (crossfadeKeyCurve == SfzCrossfadeCurve::gain)
-                baseGain *= crossfadePosition;
-        }
-
-        if (noteNumber > crossfadeKeyOutRange.getEnd())
-            baseGain = 0.0f;
-        else if (noteNumber > crossfadeKeyOutRange.getStart())
-        {
-            const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeKeyOutRange.getStart()) / crossfadeKeyOutRange.getLength();
-            if (crossfadeKeyCurve == SfzCrossfadeCurve::power)
-                baseGain *= sqrt(1 - crossfadePosition);
-            if (crossfadeKeyCurve == SfzCrossfadeCurve::gain)
-                baseGain *= 1 - crossfadePosition;
-        }
-
-        if (velocity < crossfadeVelInRange.getStart())
-            baseGain = 0;
-        else if (velocity < crossfadeVelInRange.getEnd())
-        {
-            const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeVelInRange.getStart()) / crossfadeVelInRange.getLength();
-            if (crossfadeVelCurve == SfzCrossfadeCurve::power)
-                baseGain *= sqrt(crossfadePosition);
-            if (crossfadeVelCurve == SfzCrossfadeCurve::gain)
-                baseGain *= crossfadePosition;
-        }
-
-        if (velocity > crossfadeVelOutRange.getEnd())
-            baseGain = 0;
-        else if (velocity > crossfadeVelOutRange.getStart())
-        {
-            const auto crossfadePosition = static_cast<float>(noteNumber - crossfadeVelOutRange.getStart()) / crossfadeVelOutRange.getLength();
-            if (crossfadeVelCurve == SfzCrossfadeCurve::power)
-                baseGain *= sqrt(1 - crossfadePosition);
-            if (crossfadeVelCurve == SfzCrossfadeCurve::gain)
-                baseGain *= 1 - crossfadePosition;
-        }
-
-        return baseGain;
+        // Release key regions play with the velocity of the note-on
+        if (trigger == SfzTrigger::release_key && !lastNoteVelocities.empty())
+            velocity = lastNoteVelocities[noteNumber];
+
+        return lookup(keyCrossfadeGains, keyRange.getStart(), noteNumber, [&]() { return computeKeyCrossfadeGain(noteNumber); })
+            * lookup(velocityGains, velocityRange.getStart(), velocity, [&]() { return computeVelocityGain(velocity); });
     }
     bool isRelease() const noexcept { return trigger == SfzTrigger::release || trigger == SfzTrigger::release_key; }
     bool isSwitchedOn() const noexcept;
@@ -165,7 +125,7 @@ struct SfzRegion
 
     // Region logic: triggers
     SfzTrigger trigger { SfzDefault::trigger }; // trigger
-    std::array<uint8_t, 128> lastNoteVelocities; // Keeps the velocities of the previous note-ons if the region has the trigger release_key
+    std::vector<uint8_t> lastNoteVelocities; // The velocities of the previous note-ons; only sized by prepare() for release_key and sw_vel=previous
     SfzContainer<Range<uint8_t>> ccTriggers { SfzDefault::ccTriggerValueRange }; // on_loccN on_hiccN
 
     // Performance parameters: amplifier
@@ -209,7 +169,7 @@ struct SfzRegion
     int numChannels { 1 };
 
     std::vector<std::string> unknownOpcodes;
-    std::shared_ptr<AudioBuffer<float>> preloadedData;
+    SfzSampleId sampleId { invalidSampleId }; // Resolved by prepare()
 private:
     bool prepared { false };
     File rootDirectory { File::getCurrentWorkingDirectory() };
@@ -221,16 +181,61 @@ private:
     bool keySwitched { true };
     bool previousKeySwitched { true };
     bool sequenceSwitched { true };
-    std::array<bool, 128> ccSwitched;
+    std::bitset<128> ccSwitched;
     bool pitchSwitched { true };
     bool bpmSwitched { true };
     bool aftertouchSwitched { true };
     int activeNotesInRange { -1 };
 
     int sequenceCounter { 0 };
+
+    // Note-on tables, baked by prepare() over the key and velocity ranges of the region
+    std::vector<float> keyCrossfadeGains;
+    std::vector<float> keyPitchRatios;
+    std::vector<float> velocityGains; // velocity curve and crossfades
+    std::vector<float> velocityPitchRatios; // empty without pitch_veltrack
+    void bakeNoteTables();
+    float computeKeyCrossfadeGain(int noteNumber) const noexcept;
+    float computeKeyPitchRatio(int noteNumber) const noexcept;
+    float computeVelocityGain(uint8_t velocity) const noexcept;
+    float computeVelocityPitchRatio(uint8_t velocity) const noexcept;
+    template<class Compute>
+    static float lookup(const std::vector<float>& table, int firstIndex, int index, Compute&& compute) noexcept
+    {
+        const auto position = index - firstIndex;
+        if (position >= 0 && position < static_cast<int>(table.size()))
+            return table[position];
+        return compute();
+    }
+
     bool setupSource();
     void addEndpointsToVelocityCurve();
     void checkInitialConditions();
     JUCE_LEAK_DETECTOR (SfzRegion)
     
-};
\ No newline at end of file
+};
+
+/**
+ * What note and CC dispatch look at first for every region, kept by the synth
+ * in a dense array next to the regions. A note outside of the key and
+ * keyswitch ranges of a region cannot change its state nor trigger it, so only
+ * the regions that pass the filter go through SfzRegion::registerNoteOn().
+ */
+struct SfzRegionFilter
+{
+    SfzRegionFilter(const SfzRegion& region)
+    : channelRange(region.channelRange), keyRange(region.keyRange), keyswitchRange(region.keyswitchRange)
+    {
+
+    }
+
+    bool isConcernedByNote(int channel, int noteNumber) const noexcept
+    {
+        return withinRange(channelRange, channel)
+            && (withinRange(keyRange, noteNumber) || withinRange(keyswitchRange, noteNumber));
+    }
+
+    Range<uint8_t> channelRange;
+    Range<uint8_t> keyRange;
+    Range<uint8_t> keyswitchRange;
+};
@@ -0,0 +1,99 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+ * The preloaded sample data of all the synths in the process, so that
+ * several instances of a plugin loading the same library share its memory
+ * and read it from disk only once.
+ *
+ * The entries are keyed by the identity of the sample file (see
+ * SfzFilePool::getSampleKey()) and only hold weak references: the data lives
+ * as long as one of the file pools uses it, and goes away with the last one.
+ */
+class SfzSharedSamples
+{
+public:
+    SfzSharedSamples() = default;
+
+    static SfzSharedSamples& getInstance()
+    {
+        static SfzSharedSamples instance;
+        return instance;
+    }
+
+    /**
+     * Get the preloaded data of a sample if some synth has at least numFrames of it.
+     */
+    std::shared_ptr<AudioBuffer<float>> find(const String& key, int numFrames)
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        const auto entry = entries.find(key);
+        if (entry == entries.end())
+            return {};
+
+        auto data = entry->second.lock();
+        if (data == nullptr || data->getNumSamples() < numFrames)
+            return {};
+
+        return data;
+    }
+
+    /**
+     * Offer freshly preloaded data to the other synths. It replaces the
+     * current entry unless that one is still in use and longer.
+     */
+    void publish(const String& key, const std::shared_ptr<AudioBuffer<float>>& data)
+    {
+        jassert(data != nullptr);
+        std::lock_guard<std::mutex> lock { mutex };
+        auto& entry = entries[key];
+        const auto current = entry.lock();
+        if (current == nullptr || current->getNumSamples() < data->getNumSamples())
+            entry = data;
+
+        // Forget the samples nobody uses anymore once in a while
+        if (++numPublished % purgePeriod == 0)
+        {
+            for (auto it = entries.begin(); it != entries.end();)
+                it = it->second.expired() ? entries.erase(it) : std::next(it);
+        }
+    }
+
+    int getNumSamplesInUse()
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        return static_cast<int>(std::count_if(entries.begin(), entries.end(), [](const auto& entry) { return !entry.second.expired(); }));
+    }
+private:
+    static constexpr int purgePeriod { 256 };
+    std::mutex mutex;
+    std::map<String, std::weak_ptr<AudioBuffer<float>>> entries;
+    int numPublished { 0 };
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzSharedSamples)
+};
@@ -0,0 +1,378 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include "SfzUring.h"
+#include <memory>
+#include <array>
+
+#if SFZ_IO_URING
+#include <fcntl.h>
+#endif
+
+/**
+ * Reads frames of a sample file into float buffers, the way the streaming
+ * voices and the preloading need them: mono files fill both channels.
+ */
+class SfzStreamReader
+{
+public:
+    struct Segment
+    {
+        AudioBuffer<float>* destination { nullptr };
+        int destinationFrame { 0 };
+        int64 sourceFrame { 0 };
+        int numFrames { 0 };
+    };
+
+    virtual ~SfzStreamReader() = default;
+    /**
+     * Read all the segments; returns false on a read error.
+     * Frames past the end of the file are cleared.
+     */
+    virtual bool read(const Segment* segments, int numSegments) = 0;
+    int64 getLengthInSamples() const noexcept { return lengthInSamples; }
+protected:
+    int64 lengthInSamples { 0 };
+};
+
+/**
+ * Reads through a JUCE AudioFormatReader, one blocking read per segment.
+ * This works for any format JUCE can decode.
+ */
+class SfzAudioFormatStreamReader: public SfzStreamReader
+{
+public:
+    SfzAudioFormatStreamReader(std::unique_ptr<AudioFormatReader> formatReader)
+    : reader(std::move(formatReader))
+    {
+        jassert(reader != nullptr);
+        lengthInSamples = reader->lengthInSamples;
+    }
+
+    bool read(const Segment* segments, int numSegments) override
+    {
+        bool success { true };
+        for (int segmentIdx = 0; segmentIdx < numSegments; ++segmentIdx)
+        {
+            const auto& segment = segments[segmentIdx];
+            success &= reader->read(segment.destination, segment.destinationFrame, segment.numFrames, segment.sourceFrame, true, true);
+        }
+        return success;
+    }
+private:
+    std::unique_ptr<AudioFormatReader> reader;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzAudioFormatStreamReader)
+};
+
+#if SFZ_IO_URING
+/**
+ * Reads uncompressed wav files through the io_uring of the calling thread.
+ * All the segments of a call are submitted as one batch in the ring staging
+ * memory and decoded from there, so a voice refilling its whole chunk ring
+ * costs a single system call instead of a seek and read per chunk.
+ */
+class SfzUringStreamReader: public SfzStreamReader
+{
+public:
+    /**
+     * Returns nullptr if the file is not a wav file we can decode ourselves
+     * or if io_uring is not usable on the calling thread.
+     */
+    static std::unique_ptr<SfzStreamReader> create(const File& file)
+    {
+        if (SfzUring::getThreadRing() == nullptr)
+            return {};
+
+        const auto fileDescriptor = ::open(file.getFullPathName().toRawUTF8(), O_RDONLY | O_CLOEXEC);
+        if (fileDescriptor < 0)
+            return {};
+
+        std::unique_ptr<SfzUringStreamReader> reader { new SfzUringStreamReader(fileDescriptor) };
+        if (!reader->parseWaveHeader(0))
+            return {};
+
+        return reader;
+    }
+
+    /**
+     * Same as above for a wav file stored at some offset of an open file, e.g.
+     * in a packed instrument. The descriptor is duplicated so the caller keeps
+     * ownership of its own.
+     */
+    static std::unique_ptr<SfzStreamReader> create(int fileDescriptor, int64 offset)
+    {
+        if (SfzUring::getThreadRing() == nullptr)
+            return {};
+
+        const auto duplicateDescriptor = ::fcntl(fileDescriptor, F_DUPFD_CLOEXEC, 0);
+        if (duplicateDescriptor < 0)
+            return {};
+
+        std::unique_ptr<SfzUringStreamReader> reader { new SfzUringStreamReader(duplicateDescriptor) };
+        if (!reader->parseWaveHeader(offset))
+            return {};
+
+        return reader;
+    }
+
+    ~SfzUringStreamReader()
+    {
+        ::close(fileDescriptor);
+    }
+
+    bool read(const Segment* segments, int numSegments) override
+    {
+        auto* ring = SfzUring::getThreadRing();
+        if (ring == nullptr)
+            return false;
+
+        const auto maxReads = jmin(static_cast<int>(ring->getQueueDepth()), config::uringQueueDepth);
+        const auto frameSize = static_cast<size_t>(bytesPerFrame);
+        bool success { true };
+        int numReads { 0 };
+        size_t stagingUsed { 0 };
+
+        for (int segmentIdx = 0; segmentIdx < numSegments; ++segmentIdx)
+        {
+            const auto& segment = segments[segmentIdx];
+            // Past the end of the data there is nothing to read
+            const auto availableFrames = jlimit<int64>(0, segment.numFrames, lengthInSamples - segment.sourceFrame);
+            if (availableFrames < segment.numFrames)
+                clearFrames(segment.destination, segment.destinationFrame + static_cast<int>(availableFrames), segment.numFrames - static_cast<int>(availableFrames));
+
+            // Segments larger than the staging space are split over several batches
+            for (int frameIdx = 0; frameIdx < availableFrames;)
+            {
+                auto numFrames = static_cast<int>(jmin<int64>(availableFrames - frameIdx, static_cast<int64>((ring->getStagingSize() - stagingUsed) / frameSize)));
+                if (numFrames == 0 || numReads == maxReads)
+                {
+                    success &= runBatch(*ring, numReads);
+                    numReads = 0;
+                    stagingUsed = 0;
+                    continue;
+                }
+
+                auto& read = reads[numReads];
+                read.fileDescriptor = fileDescriptor;
+                read.offset = static_cast<uint64_t>(dataOffset + (segment.sourceFrame + frameIdx) * bytesPerFrame);
+                read.length = static_cast<uint32_t>(numFrames * frameSize);
+                read.destination = ring->getStaging() + stagingUsed;
+                targets[numReads] = { segment.destination, segment.destinationFrame + frameIdx, segment.sourceFrame + frameIdx, numFrames };
+                ++numReads;
+                stagingUsed += read.length;
+                frameIdx += numFrames;
+            }
+        }
+
+        return runBatch(*ring, numReads) && success;
+    }
+private:
+    SfzUringStreamReader(int fileDescriptor)
+    : fileDescriptor(fileDescriptor)
+    {
+    }
+
+    bool runBatch(SfzUring& ring, int numReads) noexcept
+    {
+        if (numReads == 0)
+            return true;
+
+        // The reads are clamped to the data of the file, so a short read has more to come:
+        // the rest of it is submitted again until it is complete or fails
+        std::array<uint32_t, config::uringQueueDepth> bytesRead {};
+        std::array<bool, config::uringQueueDepth> failed {};
+        std::array<SfzUringRead, config::uringQueueDepth> parts;
+        std::array<int, config::uringQueueDepth> partReads;
+        for (;;)
+        {
+            int numParts { 0 };
+            for (int readIdx = 0; readIdx < numReads; ++readIdx)
+            {
+                const auto& read = reads[readIdx];
+                if (failed[readIdx] || bytesRead[readIdx] == read.length)
+                    continue;
+
+                auto& part = parts[numParts];
+                part = read;
+                part.offset += bytesRead[readIdx];
+                part.length -= bytesRead[readIdx];
+                part.destination += bytesRead[readIdx];
+                partReads[numParts++] = readIdx;
+            }
+
+            if (numParts == 0)
+                break;
+
+            const bool submitted = ring.read(parts.data(), numParts);
+            for (int partIdx = 0; partIdx < numParts; ++partIdx)
+            {
+                const auto readIdx = partReads[partIdx];
+                // Reading nothing means the file is shorter than its header says
+                if (!submitted || parts[partIdx].result <= 0)
+                    failed[readIdx] = true;
+                else
+                    bytesRead[readIdx] += static_cast<uint32_t>(parts[partIdx].result);
+            }
+        }
+
+        bool success { true };
+        for (int readIdx = 0; readIdx < numReads; ++readIdx)
+        {
+            const auto& target = targets[readIdx];
+            if (failed[readIdx])
+            {
+                clearFrames(target.destination, target.destinationFrame, target.numFrames);
+                success = false;
+                continue;
+            }
+
+            decode(reads[readIdx].destination, target.destination, target.destinationFrame, target.numFrames);
+        }
+        return success;
+    }
+
+    void decode(const uint8_t* source, AudioBuffer<float>* destination, int destinationFrame, int numFrames) const noexcept
+    {
+        const auto bytesPerSample = bytesPerFrame / numChannels;
+        const auto rightOffset = numChannels > 1 ? bytesPerSample : 0;
+        auto* left = destination->getWritePointer(0, destinationFrame);
+        auto* right = destination->getNumChannels() > 1 ? destination->getWritePointer(1, destinationFrame) : nullptr;
+
+        auto decodeWith = [&](auto decodeSample) {
+            for (int frameIdx = 0; frameIdx < numFrames; ++frameIdx, source += bytesPerFrame)
+            {
+                left[frameIdx] = decodeSample(source);
+                if (right != nullptr)
+                    right[frameIdx] = decodeSample(source + rightOffset);
+            }
+        };
+
+        if (isFloatingPoint)
+        {
+            decodeWith([](const uint8_t* sample) {
+                float value;
+                std::memcpy(&value, sample, sizeof(value));
+                return value;
+            });
+        }
+        else if (bytesPerSample == 2)
+        {
+            decodeWith([](const uint8_t* sample) {
+                return static_cast<float>(static_cast<int16_t>(sample[0] | (sample[1] << 8))) / 32768.0f;
+            });
+        }
+        else if (bytesPerSample == 3)
+        {
+            decodeWith([](const uint8_t* sample) {
+                const auto value = static_cast<int32_t>((static_cast<uint32_t>(sample[0]) << 8) | (static_cast<uint32_t>(sample[1]) << 16) | (static_cast<uint32_t>(sample[2]) << 24));
+                return static_cast<float>(value >> 8) / 8388608.0f;
+            });
+        }
+        else
+        {
+            decodeWith([](const uint8_t* sample) {
+                const auto value = static_cast<int32_t>(static_cast<uint32_t>(sample[0]) | (static_cast<uint32_t>(sample[1]) << 8) | (static_cast<uint32_t>(sample[2]) << 16) | (static_cast<uint32_t>(sample[3]) << 24));
+                return static_cast<float>(static_cast<double>(value) / 2147483648.0);
+            });
+        }
+    }
+
+    static void clearFrames(AudioBuffer<float>* destination, int destinationFrame, int numFrames) noexcept
+    {
+        if (numFrames > 0)
+            destination->clear(destinationFrame, numFrames);
+    }
+
+    /**
+     * Find the sample format and the data chunk; only plain PCM (16, 24 and
+     * 32 bits) and 32 bits float files are handled here.
+     */
+    bool parseWaveHeader(int64 offset)
+    {
+        auto readLittleEndian = [](const uint8_t* bytes, int numBytes) {
+            uint32_t value { 0 };
+            for (int byteIdx = numBytes - 1; byteIdx >= 0; --byteIdx)
+                value = (value << 8) | bytes[byteIdx];
+            return value;
+        };
+
+        uint8_t header[12];
+        if (::pread(fileDescriptor, header, sizeof(header), offset) != sizeof(header)
+            || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0)
+            return false;
+
+        bool formatFound { false };
+        int64 position { offset + 12 };
+        for (;;)
+        {
+            uint8_t chunkHeader[8];
+            if (::pread(fileDescriptor, chunkHeader, sizeof(chunkHeader), position) != sizeof(chunkHeader))
+                return false;
+
+            const auto chunkSize = static_cast<int64>(readLittleEndian(chunkHeader + 4, 4));
+            position += sizeof(chunkHeader);
+            if (std::memcmp(chunkHeader, "fmt ", 4) == 0)
+            {
+                uint8_t format[40] {};
+                const auto formatSize = static_cast<size_t>(jmin<int64>(chunkSize, sizeof(format)));
+                if (formatSize < 16 || ::pread(fileDescriptor, format, formatSize, position) != static_cast<ssize_t>(formatSize))
+                    return false;
+
+                auto formatTag = readLittleEndian(format, 2);
+                numChannels = static_cast<int>(readLittleEndian(format + 2, 2));
+                bytesPerFrame = static_cast<int>(readLittleEndian(format + 12, 2));
+                const auto bitsPerSample = static_cast<int>(readLittleEndian(format + 14, 2));
+                if (formatTag == 0xFFFE && formatSize >= 26) // WAVE_FORMAT_EXTENSIBLE: the actual tag starts the sub-format
+                    formatTag = readLittleEndian(format + 24, 2);
+
+                isFloatingPoint = formatTag == 3;
+                const bool supportedInteger = formatTag == 1 && (bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+                const bool supportedFloat = isFloatingPoint && bitsPerSample == 32;
+                if (!(supportedInteger || supportedFloat) || numChannels < 1 || bytesPerFrame != numChannels * bitsPerSample / 8)
+                    return false;
+                formatFound = true;
+            }
+            else if (std::memcmp(chunkHeader, "data", 4) == 0)
+            {
+                if (!formatFound)
+                    return false;
+                dataOffset = position;
+                lengthInSamples = chunkSize / bytesPerFrame;
+                return true;
+            }
+            // Chunks are padded to an even size
+            position += chunkSize + (chunkSize & 1);
+        }
+    }
+
+    int fileDescriptor { -1 };
+    int64 dataOffset { 0 };
+    int numChannels { 0 };
+    int bytesPerFrame { 0 };
+    bool isFloatingPoint { false };
+    std::array<SfzUringRead, config::uringQueueDepth> reads;
+    std::array<Segment, config::uringQueueDepth> targets;
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzUringStreamReader)
+};
+#endif
@@ -21,7 +21,6 @@
 
 #include "SfzSynth.h"
 #include <string>
-#include <fstream>
 #include <regex>
 #include <algorithm>
 #include <string_view>
@@ -37,117 +36,25 @@ SfzSynth::SfzSynth()
 
 SfzSynth::~SfzSynth()
 {
-
+	articulationLoader.reset();
+	// The I/O threads may still hold requests for the voices
+	ioQueue.stop();
 }
 
 void SfzSynth::initalizeVoices(int numVoices)
 {
+	ioQueue.stop();
+	// Give the streaming chunks back before the voices go away
+	for (auto& voice: voices)
+		voice.reset();
     voices.clear();
 	for (int i = 0; i < numVoices; ++i)
 	{
-		auto & voice = voices.emplace_back(fileLoadingPool, filePool, ccState);
+		auto & voice = voices.emplace_back(ioQueue, filePool, ccState, random);
 		voice.prepareToPlay(sampleRate, samplesPerBlock);
 	}
-}
-
-void removeCommentOnLine(std::string_view& line)
-{
-	if (auto position = line.find("//"); position != line.npos)
-		line.remove_suffix(line.size() - position);
-}
-
-std::string joinIntoString(const std::vector<std::string>& lines)
-{
-	std::size_t fullLength = 0;
-	for (const auto &line : lines) 
-		fullLength += line.length() + 1;
-
-	std::string fullString;
-	fullString.reserve(fullLength);
-	for (const auto &line : lines)
-	{
-		fullString += line;
-		fullString += ' ';
-	}
-	return std::move(fullString);
-}
-
-void SfzSynth::readSfzFile(const std::filesystem::path& fileName, std::vector<std::string>& lines) noexcept
-{
-	std::ifstream fileStream(fileName.c_str());
-	if (!fileStream)
-		return;
-
-	svmatch_results includeMatch;
-	svmatch_results defineMatch;
-
-	std::string tmpString;
-	while (std::getline(fileStream, tmpString))
-	{
-		std::string_view tmpView { tmpString };
-
-		removeCommentOnLine(tmpView);
-		trimView(tmpView);
-
-		if (tmpView.empty())
-			continue;
-
-		// New #include
-		if (std::regex_search(tmpView.begin(), tmpView.end(), includeMatch, SfzRegexes::includes))
-		{
-			auto includePath = includeMatch.str(1);
-			std::replace(includePath.begin(), includePath.end(), '\\', '/');
-			const auto newFile = rootDirectory / includePath;			
-			auto alreadyIncluded = std::find(includedFiles.begin(), includedFiles.end(), newFile);
-			if (std::filesystem::exists(newFile) && alreadyIncluded == includedFiles.end())
-			{
-				includedFiles.push_back(newFile);
-				readSfzFile(newFile, lines);
-			}
-			continue;
-		}
-
-		// New #define
-		if (std::regex_search(tmpView.begin(), tmpView.end(), defineMatch, SfzRegexes::defines))
-		{
-			defines[defineMatch.str(1)] = defineMatch.str(2);
-			continue;
-		}
-
-		// Replace defined variables starting with $
-		std::string newString;
-		newString.reserve(tmpView.length());
-		std::string::size_type lastPos = 0;
-    	std::string::size_type findPos = tmpView.find(config::defineCharacter, lastPos);
-
-		while(findPos < tmpView.npos)
-		{
-			newString.append(tmpView, lastPos, findPos - lastPos);
-
-			for (auto& definePair: defines)
-			{
-				std::string_view candidate = tmpView.substr(findPos, definePair.first.length());
-				if (candidate == definePair.first)
-				{
-					newString += definePair.second;
-					lastPos = findPos + definePair.first.length();
-					break;
-				}
-			}
-			
-			if (lastPos <= findPos)
-			{
-				newString += config::defineCharacter;
-				lastPos = findPos + 1;
-			}
-
-			findPos = tmpView.find(config::defineCharacter, lastPos);
-		}
-
-		// Copy the rest of the string
-		newString += tmpView.substr(lastPos);
-		lines.push_back(std::move(newString));		
-	}
+	filePool.prepareStreaming(numVoices, samplesPerBlock);
+	ioQueue.start();
 }
 
 bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
@@ -159,11 +66,26 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 
 	rootDirectory = file.parent_path();
 	filePool.setRootDirectory(File(rootDirectory.string()));
-	std::vector<std::string> lines;
-	readSfzFile(file, lines);
 
-	const auto fullString = joinIntoString(lines);
-	const std::string_view fullStringView { fullString };
+	const File sfzJuceFile { sfzFile.string() };
+	if (SfzPackedInstrument::isPackedInstrument(sfzJuceFile))
+	{
+		// The sfz text of a pack is already preprocessed and its samples are read from the pack
+		auto packedInstrument = std::make_shared<SfzPackedInstrument>(sfzJuceFile);
+		if (!packedInstrument->isValid())
+			return false;
+		preprocessedSfz = packedInstrument->getSfzText();
+		filePool.setPackedInstrument(std::move(packedInstrument));
+	}
+	else
+	{
+		SfzPreprocessor preprocessor { rootDirectory };
+		preprocessedSfz = preprocessor.process(file);
+		includedFiles = preprocessor.getIncludedFiles();
+		defines = preprocessor.getDefines();
+	}
+
+	const std::string_view fullStringView { preprocessedSfz };
 
 	svregex_iterator headerIterator(fullStringView.cbegin(), fullStringView.cend(), SfzRegexes::headers);
 	const auto regexEnd = svregex_iterator();
@@ -179,16 +101,37 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 	bool hasGlobal = false;
 	bool hasControl = false;
 	
+	// The inherited opcodes are applied once to a prototype region per header level,
+	// which the regions of a group are then copied from. The prototypes are rebuilt
+	// lazily when the opcodes of their level or of a level above change.
+	std::optional<SfzRegion> globalPrototype;
+	std::optional<SfzRegion> masterPrototype;
+	std::optional<SfzRegion> groupPrototype;
+
+	auto getGroupPrototype = [&, this]() -> const SfzRegion& {
+		if (!globalPrototype)
+		{
+			globalPrototype.emplace(File(rootDirectory.string()), filePool);
+			for (auto& opcode: globalMembers)
+				globalPrototype->parseOpcode(opcode);
+		}
+		if (!masterPrototype)
+		{
+			masterPrototype.emplace(*globalPrototype);
+			for (auto& opcode: masterMembers)
+				masterPrototype->parseOpcode(opcode);
+		}
+		if (!groupPrototype)
+		{
+			groupPrototype.emplace(*masterPrototype);
+			for (auto& opcode: groupMembers)
+				groupPrototype->parseOpcode(opcode);
+		}
+		return *groupPrototype;
+	};
+
 	auto buildRegion = [&, this]() {
-		regions.emplace_back(File(rootDirectory.string()), filePool);
-		auto& region = regions.back(); // For some reason using auto& region up there does not work?!
-		// Successively apply the opcodes alread read to the parameter structure
-		for (auto& opcode: globalMembers)
-			region.parseOpcode(opcode);
-		for (auto& opcode: masterMembers)
-			region.parseOpcode(opcode);
-		for (auto& opcode: groupMembers)
-			region.parseOpcode(opcode);
+		auto& region = regions.emplace_back(getGroupPrototype());
 		for (auto& opcode: regionMembers)
 			region.parseOpcode(opcode);
 		regionMembers.clear();	
@@ -231,10 +174,13 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 				numMasters += 1;
 				groupMembers.clear();
 				masterMembers.clear();
+				masterPrototype.reset();
+				groupPrototype.reset();
 				break;
 			case hash("group"):
 				numGroups += 1;
 				groupMembers.clear();
+				groupPrototype.reset();
 				break;
 			case hash("region"):
 				regionStarted = true;
@@ -264,13 +210,21 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 				if (opcode == "sw_default")
 					setValueFromOpcode({opcode, value}, defaultSwitch, SfzDefault::keyRange);
 				else
+				{
 					globalMembers.emplace_back(opcode, value);
+					globalPrototype.reset();
+					masterPrototype.reset();
+					groupPrototype.reset();
+				}
 				break;
 			case hash("master"):
 				masterMembers.emplace_back(opcode, value);
+				masterPrototype.reset();
+				groupPrototype.reset();
 				break;
 			case hash("group"):
 				groupMembers.emplace_back(opcode, value);
+				groupPrototype.reset();
 				break;
 			case hash("region"):
 				regionMembers.emplace_back(opcode, value);
@@ -278,7 +232,7 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 			case hash("control"):
 			{
 				SfzOpcode lastOpcode{opcode, value};
-				switch (hash(lastOpcode.opcode))
+				switch (lastOpcode.opcodeHash)
 				{
 				case hash("set_cc"):
 					if (lastOpcode.parameter && withinRange(SfzDefault::ccRange, *lastOpcode.parameter))
@@ -322,9 +276,11 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 	// Sort the CC labels
 	std::sort(begin(ccNames), end(ccNames), [](auto& lhs, auto& rhs) { return lhs.first < rhs.first; });
 
+	// Lazily loaded articulations are preloaded by the articulation loader, the rest right away
+	const bool deferPreload = articulationLoading != SfzArticulationLoading::eager;
 	for (auto& region: regions)
 	{
-		region.prepare();
+		region.prepare(deferPreload);
 		
 		for (int ccIdx = 1; ccIdx < 128; ccIdx++)
 		{
@@ -337,6 +293,26 @@ bool SfzSynth::loadSfzFile(const std::filesystem::path &file)
 			region.registerNoteOff(region.channelRange.getStart(), *defaultSwitch, 0, 1.0f);
 		}
 	}
+
+	// Dispatch indices: only the regions concerned by an event are looked at
+	regionFilters.reserve(regions.size());
+	for (int regionIdx = 0; regionIdx < getNumRegions(); ++regionIdx)
+	{
+		const auto& region = regions[regionIdx];
+		regionFilters.emplace_back(region);
+		for (const auto& condition: region.ccConditions)
+			regionsByCC[condition.first].push_back(regionIdx);
+		for (const auto& trigger: region.ccTriggers)
+		{
+			if (!region.ccConditions.contains(trigger.first))
+				regionsByCC[trigger.first].push_back(regionIdx);
+		}
+	}
+
+	if (deferPreload)
+		articulationLoader = std::make_unique<SfzArticulationLoader>(regions, filePool, defaultSwitch, articulationLoading, articulationReleaseTimeout);
+
+	filePool.finishLoading();
 	return true;
 }
 
@@ -380,12 +356,44 @@ const SfzRegion* SfzSynth::getRegionView(int num) const
 void SfzSynth::clear()
 {
 	ccNames.clear();
-	regions.clear();
+	articulationLoader.reset();
+	ioQueue.stop();
 	for (auto& voice: voices)
 		voice.reset();
+	ioQueue.start();
+	regions.clear();
+	regionFilters.clear();
+	for (auto& ccRegions: regionsByCC)
+		ccRegions.clear();
 	filePool.clear();
 	resetMidiState();
 	defines.clear();
+	includedFiles.clear();
+	preprocessedSfz.clear();
+}
+
+bool SfzSynth::exportPackedInstrument(const File& output)
+{
+	if (regions.empty())
+		return false;
+
+	// The file pool knows where the samples are, default_path included
+	std::vector<std::pair<String, File>> samples;
+	for (const auto& region: regions)
+	{
+		if (region.isGenerator())
+			continue;
+
+		const auto alreadyPacked = std::find_if(samples.cbegin(), samples.cend(), [&region](const auto& sample) {
+			return sample.first == region.sample;
+		});
+		if (alreadyPacked == samples.cend())
+			samples.emplace_back(region.sample, filePool.getSampleFile(region.sample));
+	}
+
+	AudioFormatManager formatManager;
+	formatManager.registerBasicFormats();
+	return SfzPackedInstrument::pack(preprocessedSfz, samples, output, formatManager);
 }
 
 void SfzSynth::resetMidiState()
@@ -398,17 +406,26 @@ void SfzSynth::prepareToPlay(double newSampleRate, int newSamplesPerBlock)
 {
 	this->sampleRate = newSampleRate;
 	this->samplesPerBlock = newSamplesPerBlock;
+	ioQueue.stop();
 	for (auto& voice: voices)
 		voice.prepareToPlay(newSampleRate, newSamplesPerBlock);
-	tempBuffer = AudioBuffer<float>(config::numChannels, newSamplesPerBlock);
+	filePool.prepareStreaming(static_cast<int>(voices.size()), newSamplesPerBlock);
+	ioQueue.start();
 }
 
 void SfzSynth::registerNoteOn(int channel, int noteNumber, uint8_t velocity, int timestamp)
 {
-	const auto randValue = Random::getSystemRandom().nextFloat();
+	const auto randValue = random.nextFloat();
 
-	for (auto& region: regions)
+	if (articulationLoader != nullptr)
+		articulationLoader->registerNoteOn(noteNumber);
+
+	for (size_t regionIdx = 0; regionIdx < regionFilters.size(); ++regionIdx)
 	{
+		if (!regionFilters[regionIdx].isConcernedByNote(channel, noteNumber))
+			continue;
+
+		auto& region = regions[regionIdx];
 		if (region.registerNoteOn(channel, noteNumber, velocity, randValue))
 		{
 			for (auto& voice: voices)
@@ -427,10 +444,14 @@ void SfzSynth::registerNoteOn(int channel, int noteNumber, uint8_t velocity, int
 
 void SfzSynth::registerNoteOff(int channel, int noteNumber, uint8_t velocity, int timestamp)
 {
-	const auto randValue = Random::getSystemRandom().nextFloat();
+	const auto randValue = random.nextFloat();
 	
-	for (auto& region: regions)
+	for (size_t regionIdx = 0; regionIdx < regionFilters.size(); ++regionIdx)
 	{
+		if (!regionFilters[regionIdx].isConcernedByNote(channel, noteNumber))
+			continue;
+
+		auto& region = regions[regionIdx];
 		if (region.registerNoteOff(channel, noteNumber, velocity, randValue))
 		{
 			auto freeVoice = std::find_if(voices.begin(), voices.end(), [](auto& voice) { return voice.isFree(); });
@@ -448,8 +469,10 @@ void SfzSynth::registerCC(int channel, int ccNumber, uint8_t ccValue, int timest
 {
 	ccState[ccNumber] = ccValue;
 
-	for (auto& region: regions)
+	// A region without a condition nor a trigger on this CC is not changed by it
+	for (auto regionIdx: regionsByCC[ccNumber])
 	{
+		auto& region = regions[regionIdx];
 		if (region.registerCC(channel, ccNumber, ccValue))
 		{
 			auto freeVoice = std::find_if(voices.begin(), voices.end(), [](auto& voice) { return voice.isFree(); });
@@ -464,13 +487,59 @@ void SfzSynth::registerCC(int channel, int ccNumber, uint8_t ccValue, int timest
 
 void SfzSynth::renderNextBlock(AudioBuffer<float>& outputAudio, int startSample, int numSamples)
 {
-	// Render all the voices
-	for (auto& voice: voices)
+	// Render all the voices one quantum at a time, so that their working set stays the same whatever the block size
+	for (int quantumStart = startSample; quantumStart < startSample + numSamples; quantumStart += config::renderQuantum)
+	{
+		const auto quantumSize = jmin(config::renderQuantum, startSample + numSamples - quantumStart);
+		for (auto& voice: voices)
+		{
+			if (voice.isFree())
+				continue;
+
+			voice.renderNextBlock(tempBuffer, 0, quantumSize);
+			for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
+				outputAudio.addFrom(channelIdx, quantumStart, tempBuffer, channelIdx, 0, quantumSize);
+		}
+	}
+}
+
+void SfzSynth::renderNextBlock(AudioBuffer<float>& outputAudio, const MidiBuffer& midiMessages, int startSample, int numSamples)
+{
+	const auto endSample = startSample + numSamples;
+	auto sliceStart = startSample;
+	MidiBuffer::Iterator it { midiMessages };
+	it.setNextSamplePosition(startSample);
+	MidiMessage msg;
+	int timestamp;
+	while (it.getNextEvent(msg, timestamp) && timestamp < endSample)
 	{
-		voice.renderNextBlock(tempBuffer, startSample, numSamples);
-		for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
-			outputAudio.addFrom(channelIdx, startSample, tempBuffer, channelIdx, startSample, numSamples);
+		// Render up to the event unless it is too close to the start of the slice
+		if (timestamp - sliceStart >= minimumSliceSize)
+		{
+			renderNextBlock(outputAudio, sliceStart, timestamp - sliceStart);
+			sliceStart = timestamp;
+		}
+
+		// The timestamps are relative to the start of the next slice
+		registerMidiMessage(msg, timestamp - sliceStart);
 	}
+
+	if (sliceStart < endSample)
+		renderNextBlock(outputAudio, sliceStart, endSample - sliceStart);
+}
+
+void SfzSynth::registerMidiMessage(const MidiMessage& msg, int timestamp)
+{
+	if (msg.isController())
+		registerCC(msg.getChannel(), msg.getControllerNumber(), static_cast<uint8_t>(msg.getControllerValue()), timestamp);
+	if (msg.isNoteOn())
+		registerNoteOn(msg.getChannel(), msg.getNoteNumber(), msg.getVelocity(), timestamp);
+	if (msg.isNoteOff())
+		registerNoteOff(msg.getChannel(), msg.getNoteNumber(), msg.getVelocity(), timestamp);
+	if (msg.isChannelPressure())
+		registerAftertouch(msg.getChannel(), static_cast<uint8_t>(msg.getAfterTouchValue()), timestamp);
+	if (msg.isPitchWheel())
+		registerPitchWheel(msg.getChannel(), msg.getPitchWheelValue(), timestamp);
 }
 
 void SfzSynth::registerPitchWheel(int channel, int pitch, int timestamp)
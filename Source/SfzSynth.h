@@ -25,11 +25,15 @@
 #include "SfzGlobals.h"
 #include "SfzRegion.h"
 #include "SfzVoice.h"
+#include "SfzIOQueue.h"
 #include <vector>
 #include <list>
 #include <algorithm>
+#include <array>
 #include <filesystem>
 #include "SfzFilePool.h"
+#include "SfzArticulationLoader.h"
+#include "SfzPreprocessor.h"
 
 class SfzSynth
 {
@@ -40,6 +44,46 @@ public:
     void initalizeVoices(int numVoices = config::numVoices);
     void clear();
 
+    // Decoded versions of the compressed samples are kept in a directory; takes effect on the next load
+    void enableDecodedCache(const File& directory, int64 maxSizeInBytes = config::decodedCacheSize) { filePool.enableDecodedCache(directory, maxSizeInBytes); }
+    void disableDecodedCache() { filePool.disableDecodedCache(); }
+
+    // Sample information is kept between sessions in this file; a null File keeps it in memory only
+    void setMetadataCacheFile(const File& cacheFile) { filePool.setMetadataCacheFile(cacheFile); }
+
+    // The sample memory budget is shared by all the synths of the process; 0 means no limit
+    void setMemoryBudget(int64 bytes) { SfzMemoryBudget::getInstance().setLimit(bytes); SfzMemoryBudget::getInstance().enforce(); }
+    int64 getMemoryBudget() const noexcept { return SfzMemoryBudget::getInstance().getLimit(); }
+    // Bytes used by all the synths of the process, and left before the budget (-1 without a budget)
+    int64 getMemoryUsage() const noexcept { return SfzMemoryBudget::getInstance().getUsage(); }
+    int64 getMemoryHeadroom() const noexcept { return SfzMemoryBudget::getInstance().getHeadroom(); }
+    int64 getInstrumentMemoryUsage() const noexcept { return filePool.getPreloadedBytes() + filePool.getStreamingBytes(); }
+
+    // Keep the preloaded data in a region of memory locked into RAM, from the next load on; see SfzFilePool::enableLockedMemory()
+    bool lockPreloadMemory(int64 sizeInBytes, bool useHugePages = false) { return filePool.enableLockedMemory(sizeInBytes, useHugePages); }
+    void unlockPreloadMemory() { filePool.disableLockedMemory(); }
+    String getLockedMemoryStatus() const { return filePool.getLockedMemoryStatus(); }
+    int getNumUnlockedPreloads() const noexcept { return filePool.getNumUnlockedPreloads(); }
+
+    /**
+     * How to preload the articulations of keyswitched instruments, from the
+     * next load on. With a release timeout in seconds, the articulations that
+     * were not selected for that long are unloaded; see SfzArticulationLoader.
+     */
+    void setArticulationLoading(SfzArticulationLoading mode, double releaseTimeoutInSeconds = 0.0)
+    {
+        articulationLoading = mode;
+        articulationReleaseTimeout = releaseTimeoutInSeconds;
+    }
+    int getNumLazyArticulations() const noexcept { return articulationLoader != nullptr ? articulationLoader->getNumArticulations() : 0; }
+    int getNumLoadedLazyArticulations() const noexcept { return articulationLoader != nullptr ? articulationLoader->getNumLoadedArticulations() : 0; }
+
+    // Write the loaded instrument and its samples in a single .sfzpack file, which loadSfzFile() can open
+    bool exportPackedInstrument(const File& output);
+
+    // The random opcodes draw from a generator owned by the synth; with a fixed seed the same events render the same output
+    void setRandomSeed(uint64_t seed) noexcept { random.setSeed(seed); }
+
     void prepareToPlay(double sampleRate, int samplesPerBlock);
     void registerNoteOn(int channel, int noteNumber, uint8_t velocity, int timestamp);
     void registerNoteOff(int channel, int noteNumber, uint8_t velocity, int timestamp);
@@ -48,6 +92,16 @@ public:
     void registerAftertouch(int channel, uint8_t aftertouch, int timestamp);
     void registerTempo(float secondsPerQuarter, int timestamp);
     void renderNextBlock(AudioBuffer<float>& outputAudio, int startSample, int numSamples);
+    /**
+     * Render a block along with the MIDI events that fall in it. The block is
+     * rendered in slices that start at the events, so that their effects land
+     * on their sample whatever the block size; events less than the minimum
+     * slice size after the start of a slice are applied within it, through
+     * their timestamp.
+     */
+    void renderNextBlock(AudioBuffer<float>& outputAudio, const MidiBuffer& midiMessages, int startSample, int numSamples);
+    void setMinimumSliceSize(int numFrames) noexcept { minimumSliceSize = jmax(1, numFrames); }
+    int getMinimumSliceSize() const noexcept { return minimumSliceSize; }
     
     int getNumRegions() const { return static_cast<int>(regions.size()); }
     int getNumGroups() const { return numGroups; }
@@ -59,6 +113,10 @@ public:
     { 
         return static_cast<int>(std::count_if(voices.cbegin(), voices.cend(), [](const auto& voice) { return voice.isPlaying(); })); 
     }
+    uint32_t getNumUnderruns() const noexcept { return filePool.getInstrumentStatistics().underruns; }
+    uint64_t getNumStarvedFrames() const noexcept { return filePool.getInstrumentStatistics().starvedFrames; }
+    std::map<String, uint32_t> getUnderrunsPerSample() const { return filePool.getUnderrunsPerSample(); }
+    void resetUnderrunStatistics() noexcept { filePool.resetStatistics(); }
     std::map<std::string, std::string> getDefines() const { return defines; }
     std::vector<std::string> getIncludedFiles() const
     {
@@ -73,23 +131,31 @@ public:
 private:
     std::filesystem::path rootDirectory { std::filesystem::current_path() };
     AudioFormatManager afManager;
-    AudioBuffer<float> tempBuffer;
+    AudioBuffer<float> tempBuffer { config::numChannels, config::renderQuantum };
     int numGroups { 0 };
     int numMasters { 0 };
-    ThreadPool fileLoadingPool { config::numLoadingThreads };
-    void readSfzFile(const std::filesystem::path& fileName, std::vector<std::string>& lines) noexcept;
+    SfzIOQueue ioQueue { config::numLoadingThreads };
     SfzFilePool filePool { File::getCurrentWorkingDirectory() };
     double sampleRate { config::defaultSampleRate };
     int samplesPerBlock { config::defaultSamplesPerBlock };
+    int minimumSliceSize { config::minimumRenderSlice };
     std::list<SfzVoice> voices;
     std::vector<SfzRegion> regions;
+    std::vector<SfzRegionFilter> regionFilters; // One per region, see SfzRegionFilter
+    std::array<std::vector<int>, 128> regionsByCC; // The regions with a condition or a trigger on each CC
+    SfzArticulationLoading articulationLoading { SfzArticulationLoading::eager };
+    double articulationReleaseTimeout { 0.0 };
+    std::unique_ptr<SfzArticulationLoader> articulationLoader;
     std::vector<std::filesystem::path> includedFiles;
     CCValueArray ccState;
+    SfzRandom random { static_cast<uint64_t>(Random::getSystemRandom().nextInt64()) };
     std::vector<CCNamePair> ccNames;
     std::map<std::string, std::string> defines;
+    std::string preprocessedSfz;
 
     void resetMidiState();
     void checkRegionsForActivation(const MidiMessage& msg, int timestamp);
+    void registerMidiMessage(const MidiMessage& msg, int timestamp);
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SfzSynth);
 };
\ No newline at end of file
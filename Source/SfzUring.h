@@ -0,0 +1,320 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#pragma once
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SfzGlobals.h"
+#include <cstdint>
+#include <cstddef>
+
+#if JUCE_LINUX && __has_include(<linux/io_uring.h>)
+#define SFZ_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#else
+#define SFZ_IO_URING 0
+#endif
+
+/**
+ * A read to run through the ring: length bytes of the file at offset,
+ * written in the staging memory of the ring.
+ */
+struct SfzUringRead
+{
+    int fileDescriptor { -1 };
+    uint64_t offset { 0 };
+    uint32_t length { 0 };
+    uint8_t* destination { nullptr };
+    int result { 0 }; // bytes read, or a negative errno
+};
+
+#if SFZ_IO_URING
+/**
+ * A minimal io_uring instance, talking to the kernel through the raw system
+ * calls so that we do not depend on liburing. It owns a staging area that is
+ * registered with the kernel when possible, so that the reads skip the page
+ * pinning on every request; the readers decode from there.
+ *
+ * A ring is not thread-safe: use one per thread (see getThreadRing()).
+ */
+class SfzUring
+{
+public:
+    SfzUring(unsigned numEntries = config::uringQueueDepth, size_t stagingSize = config::uringStagingSize)
+    {
+        io_uring_params parameters;
+        std::memset(&parameters, 0, sizeof(parameters));
+        ringDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, numEntries, &parameters));
+        if (ringDescriptor < 0)
+        {
+            DBG("io_uring is not available: " << std::strerror(errno));
+            return;
+        }
+
+        if (!mapRings(parameters))
+        {
+            close();
+            return;
+        }
+
+        staging.malloc(stagingSize);
+        if (staging == nullptr)
+        {
+            close();
+            return;
+        }
+        stagingCapacity = stagingSize;
+
+        // Registering needs enough locked memory allowance; plain reads are fine otherwise
+        iovec stagingVector { staging.get(), stagingCapacity };
+        fixedBuffers = syscall(__NR_io_uring_register, ringDescriptor, IORING_REGISTER_BUFFERS, &stagingVector, 1) == 0;
+    }
+
+    ~SfzUring()
+    {
+        close();
+    }
+
+    bool isValid() const noexcept { return ringDescriptor >= 0; }
+    bool usesFixedBuffers() const noexcept { return fixedBuffers; }
+    uint8_t* getStaging() noexcept { return reinterpret_cast<uint8_t*>(staging.get()); }
+    size_t getStagingSize() const noexcept { return stagingCapacity; }
+    unsigned getQueueDepth() const noexcept { return numSubmissionEntries; }
+
+    /**
+     * Submit the reads in one go and wait for all of them. The destinations
+     * must lie in the staging area, and there must not be more reads than the
+     * queue depth. Returns false if some reads could not be submitted; the
+     * result of each read is in its result field.
+     */
+    bool read(SfzUringRead* reads, int numReads) noexcept
+    {
+        jassert(isValid());
+        jassert(numReads >= 0 && static_cast<unsigned>(numReads) <= numSubmissionEntries);
+
+        auto tail = submissionTail->load(std::memory_order_relaxed);
+        for (int readIdx = 0; readIdx < numReads; ++readIdx)
+        {
+            auto& read = reads[readIdx];
+            jassert(read.destination >= getStaging() && read.destination + read.length <= getStaging() + stagingCapacity);
+
+            const auto index = tail & *submissionMask;
+            auto& entry = submissionEntries[index];
+            std::memset(&entry, 0, sizeof(entry));
+            entry.fd = read.fileDescriptor;
+            entry.off = read.offset;
+            entry.user_data = static_cast<uint64_t>(readIdx);
+            if (fixedBuffers)
+            {
+                entry.opcode = IORING_OP_READ_FIXED;
+                entry.addr = reinterpret_cast<uint64_t>(read.destination);
+                entry.len = read.length;
+                entry.buf_index = 0;
+            }
+            else
+            {
+                // READV is the oldest read opcode, so this works on every kernel with io_uring
+                vectors[readIdx] = { read.destination, read.length };
+                entry.opcode = IORING_OP_READV;
+                entry.addr = reinterpret_cast<uint64_t>(&vectors[readIdx]);
+                entry.len = 1;
+            }
+            submissionArray[index] = index;
+            read.result = -EINPROGRESS;
+            ++tail;
+        }
+        submissionTail->store(tail, std::memory_order_release);
+
+        // The kernel may take fewer entries than asked, so keep submitting until all of
+        // them are in, and only wait for the reads that are in flight
+        int submitted { 0 };
+        int completed { 0 };
+        int stalledAttempts { 0 };
+        bool failed { false };
+        while (completed < submitted || (submitted < numReads && !failed))
+        {
+            if (submitted < numReads && !failed)
+            {
+                const auto entered = syscall(__NR_io_uring_enter, ringDescriptor, static_cast<unsigned>(numReads - submitted), 0u, 0u, nullptr, 0);
+                if (entered > 0)
+                {
+                    submitted += static_cast<int>(entered);
+                    stalledAttempts = 0;
+                }
+                else if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    failed = true;
+                }
+                else if (completed == submitted)
+                {
+                    // The kernel takes nothing and there is no completion to make room: give up after a few tries
+                    if (++stalledAttempts >= config::uringSubmitAttempts)
+                        failed = true;
+                    else
+                        Thread::yield();
+                }
+            }
+
+            if (completed < submitted)
+            {
+                const auto entered = syscall(__NR_io_uring_enter, ringDescriptor, 0u, static_cast<unsigned>(submitted - completed), IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered < 0 && errno != EINTR)
+                    failed = true;
+            }
+
+            auto head = completionHead->load(std::memory_order_relaxed);
+            const auto completionTailValue = completionTail->load(std::memory_order_acquire);
+            while (head != completionTailValue)
+            {
+                const auto& completion = completionEntries[head & *completionMask];
+                if (completion.user_data < static_cast<uint64_t>(numReads))
+                {
+                    reads[completion.user_data].result = completion.res;
+                    ++completed;
+                }
+                ++head;
+            }
+            completionHead->store(head, std::memory_order_release);
+
+            // Nothing in flight to wait for and the submission failed: give up
+            if (failed && completed == submitted)
+                break;
+        }
+
+        if (submitted < numReads)
+        {
+            // Take back the entries the kernel did not consume, so that the next call does not send them
+            submissionTail->store(submissionHead->load(std::memory_order_acquire), std::memory_order_release);
+            return false;
+        }
+        return !failed || completed == numReads;
+    }
+
+    /**
+     * The ring of the calling thread, created on first use.
+     * Returns nullptr if io_uring is not usable on this system.
+     */
+    static SfzUring* getThreadRing()
+    {
+        thread_local SfzUring ring;
+        return ring.isValid() ? &ring : nullptr;
+    }
+private:
+    bool mapRings(const io_uring_params& parameters)
+    {
+        submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+        completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+        const bool singleMap = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+        // The headers of kernels before 5.4 only know the layout with two maps, which the later kernels still support
+        const bool singleMap = false;
+#endif
+        if (singleMap)
+            submissionRingSize = completionRingSize = jmax(submissionRingSize, completionRingSize);
+
+        submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQ_RING);
+        if (submissionRing == MAP_FAILED)
+        {
+            submissionRing = nullptr;
+            return false;
+        }
+
+        if (singleMap)
+        {
+            completionRing = submissionRing;
+        }
+        else
+        {
+            completionRing = mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_CQ_RING);
+            if (completionRing == MAP_FAILED)
+            {
+                completionRing = nullptr;
+                return false;
+            }
+        }
+
+        submissionEntriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+        auto* entries = mmap(nullptr, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQES);
+        if (entries == MAP_FAILED)
+            return false;
+        submissionEntries = static_cast<io_uring_sqe*>(entries);
+
+        auto* submissionBase = static_cast<uint8_t*>(submissionRing);
+        auto* completionBase = static_cast<uint8_t*>(completionRing);
+        submissionHead = reinterpret_cast<std::atomic<unsigned>*>(submissionBase + parameters.sq_off.head);
+        submissionTail = reinterpret_cast<std::atomic<unsigned>*>(submissionBase + parameters.sq_off.tail);
+        submissionMask = reinterpret_cast<unsigned*>(submissionBase + parameters.sq_off.ring_mask);
+        submissionArray = reinterpret_cast<unsigned*>(submissionBase + parameters.sq_off.array);
+        completionHead = reinterpret_cast<std::atomic<unsigned>*>(completionBase + parameters.cq_off.head);
+        completionTail = reinterpret_cast<std::atomic<unsigned>*>(completionBase + parameters.cq_off.tail);
+        completionMask = reinterpret_cast<unsigned*>(completionBase + parameters.cq_off.ring_mask);
+        completionEntries = reinterpret_cast<io_uring_cqe*>(completionBase + parameters.cq_off.cqes);
+        numSubmissionEntries = jmin(parameters.sq_entries, static_cast<unsigned>(config::uringQueueDepth));
+        return true;
+    }
+
+    void close()
+    {
+        if (submissionEntries != nullptr)
+            munmap(submissionEntries, submissionEntriesSize);
+        if (completionRing != nullptr && completionRing != submissionRing)
+            munmap(completionRing, completionRingSize);
+        if (submissionRing != nullptr)
+            munmap(submissionRing, submissionRingSize);
+        submissionEntries = nullptr;
+        completionRing = submissionRing = nullptr;
+
+        if (ringDescriptor >= 0)
+            ::close(ringDescriptor);
+        ringDescriptor = -1;
+    }
+
+    int ringDescriptor { -1 };
+    void* submissionRing { nullptr };
+    void* completionRing { nullptr };
+    size_t submissionRingSize { 0 };
+    size_t completionRingSize { 0 };
+    size_t submissionEntriesSize { 0 };
+    io_uring_sqe* submissionEntries { nullptr };
+    std::atomic<unsigned>* submissionHead { nullptr };
+    std::atomic<unsigned>* submissionTail { nullptr };
+    unsigned* submissionMask { nullptr };
+    unsigned* submissionArray { nullptr };
+    std::atomic<unsigned>* completionHead { nullptr };
+    std::atomic<unsigned>* completionTail { nullptr };
+    unsigned* completionMask { nullptr };
+    io_uring_cqe* completionEntries { nullptr };
+    unsigned numSubmissionEntries { 0 };
+
+    HeapBlock<char> staging;
+    size_t stagingCapacity { 0 };
+    bool fixedBuffers { false };
+    iovec vectors[config::uringQueueDepth];
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SfzUring)
+};
+#endif
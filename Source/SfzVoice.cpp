@@ -21,25 +21,27 @@
 
 #include "SfzVoice.h"
 
-SfzVoice::SfzVoice(ThreadPool& fileLoadingPool, SfzFilePool& filePool, const CCValueArray& ccState)
-: ThreadPoolJob( "SfzVoice" )
-, fileLoadingPool(fileLoadingPool)
+SfzVoice::SfzVoice(SfzIOQueue& ioQueue, SfzFilePool& filePool, const CCValueArray& ccState, SfzRandom& random)
+: ioQueue(ioQueue)
 , filePool(filePool)
 , ccState(ccState)
+, random(random)
 {
+    // The voices render a quantum at a time, so their scratch buffers do not depend on the block size
+    tempBlock1 = dsp::AudioBlock<float>(tempHeapBlock1, config::numChannels, config::renderQuantum);
+    tempBlock2 = dsp::AudioBlock<float>(tempHeapBlock2, config::numChannels, config::renderQuantum);
+    filePool.addPreloadHazard(preloadHazard);
 }
 
-SfzVoice::~SfzVoice() noexcept
+SfzVoice::~SfzVoice()
 {
-    if (fileLoadingPool.contains(this))
-        fileLoadingPool.removeJob(this, true, 100);
+    filePool.removePreloadHazard(preloadHazard);
 }
 
 void SfzVoice::release(int timestamp, bool useFastRelease) noexcept
 {
     if (state != SfzVoiceState::release)
     {
-        DBG("Sample " << region->sample << " releasing...");
         state = SfzVoiceState::release;
         amplitudeEGEnvelope.release(timestamp, useFastRelease);  
     }
@@ -50,9 +52,10 @@ void SfzVoice::startVoiceWithNote(SfzRegion& newRegion, int channel, int noteNum
     commonStartVoice(newRegion, sampleDelay);
     triggeringNoteNumber = noteNumber;
     triggeringChannel = channel;
-    pitchRatio = region->getBasePitchVariation(noteNumber, velocity);
+    pitchRatio = region->getBasePitchVariation(noteNumber, velocity, random);
     baseGain *= region->getNoteGain(noteNumber, velocity);
     amplitudeEGEnvelope.prepare(region->amplitudeEG, ccState, velocity, sampleDelay);
+    scheduleFileLoading();
 }
 
 void SfzVoice::startVoiceWithCC(SfzRegion& newRegion, int channel, int ccNumber, uint8_t ccValue [[maybe_unused]], int sampleDelay) noexcept
@@ -60,6 +63,7 @@ void SfzVoice::startVoiceWithCC(SfzRegion& newRegion, int channel, int ccNumber,
     commonStartVoice(newRegion, sampleDelay);
     triggeringCCNumber = ccNumber;
     triggeringChannel = channel;
+    scheduleFileLoading();
 }
 
 void SfzVoice::commonStartVoice(SfzRegion& newRegion, int sampleDelay) noexcept
@@ -71,21 +75,22 @@ void SfzVoice::commonStartVoice(SfzRegion& newRegion, int sampleDelay) noexcept
     if (sampleDelay < 0)
         sampleDelay = 0;
 
-    DBG("Starting voice with " << newRegion.sample);
-
     auto secondsToSamples = [this](auto timeInSeconds) { 
         return static_cast<int>(timeInSeconds * sampleRate);
     };
 
     region = &newRegion;
     noteIsOff = false;
+    releasePending = false;
+    releaseDone = false;
     state = SfzVoiceState::playing;
 
     // Compute the resampling ratio for this region
     speedRatio = static_cast<float>(region->sampleRate / this->sampleRate);
+    pitchRatio = 1.0f;
 
     // Compute the base amplitude gain
-    baseGain = region->getBaseGain();
+    baseGain = region->getBaseGain(random);
 
     // Initialize the CC envelopes
     if (region->amplitudeCC)
@@ -99,22 +104,147 @@ void SfzVoice::commonStartVoice(SfzRegion& newRegion, int sampleDelay) noexcept
     // Initialize the source sample position and add a possibly random offset
     uint32_t totalOffset { region->offset };
     if (region->offsetRandom > 0)
-        totalOffset += Random::getSystemRandom().nextInt((int)region->offsetRandom);
+        totalOffset += random.nextInt((int)region->offsetRandom);
     sourcePosition = totalOffset;
 
-    // Now there's possibly an additional sample delay from the region opcodes
-    initialDelay = 0;
+    // The sample starts playing at the frame of the event, possibly with an additional delay from the region opcodes
+    initialDelay = sampleDelay;
     if (region->delay > 0)
         initialDelay += secondsToSamples(region->delay);
     if (region->delayRandom > 0)
-        initialDelay += Random::getSystemRandom().nextInt(secondsToSamples(region->delayRandom));
+        initialDelay += random.nextInt(secondsToSamples(region->delayRandom));
     
-    preloadedData = filePool.getPreloadedData(region->sample);
-    if (preloadedData == nullptr)
+    preloadedData = filePool.getPreloadedData(region->sampleId, preloadHazard);
+    sampleStatistics = filePool.getStatistics(region->sampleId);
+    if (sampleStatistics != nullptr)
+        sampleStatistics->plays.fetch_add(1, std::memory_order_relaxed);
+    setupStream();
+    chooseFillFunction();
+}
+
+void SfzVoice::setupStream() noexcept
+{
+    streaming = false;
+    requestedChunk = -1;
+    publishedPosition = sourcePosition;
+    if (region->isGenerator() || preloadedData == nullptr)
+    {
+        streamLength = 0;
+        return;
+    }
+
+    endOrLoopEnd = static_cast<int>(jmin(region->sampleEnd, region->loopRange.getEnd()));
+    loopStart = static_cast<int>(region->loopRange.getStart());
+    const auto loopLength = endOrLoopEnd - loopStart;
+    if (region->shouldLoop() && loopLength > 0)
+        streamLength = std::numeric_limits<int64_t>::max();
+    else if (region->sampleCount && loopLength > 0)
+        streamLength = endOrLoopEnd + static_cast<int64_t>(jmax(*region->sampleCount, 1u) - 1) * loopLength;
+    else
+        streamLength = endOrLoopEnd;
+
+    // Short samples are played from the preloaded data only
+    preloadedFrames = jmin(preloadedData->getNumSamples(), endOrLoopEnd);
+    if (preloadedFrames == endOrLoopEnd)
+        return;
+
+    chunkSize = filePool.getChunkSize();
+    for (auto& chunk: streamingChunks)
+    {
+        chunk.buffer = filePool.acquireChunk();
+        if (chunk.buffer == nullptr)
+        {
+            // The pool is sized for all the voices so this should not happen; play the preloaded head only
+            jassertfalse;
+            releaseStream();
+            streamLength = preloadedFrames;
+            return;
+        }
+    }
+    streaming = true;
+}
+
+void SfzVoice::releaseStream() noexcept
+{
+    for (auto& chunk: streamingChunks)
+    {
+        filePool.releaseChunk(chunk.buffer);
+        chunk.chunkNumber = -1;
+    }
+    streaming = false;
+}
+
+void SfzVoice::scheduleFileLoading() noexcept
+{
+    if (!streaming)
         return;
 
-    // Schedule a callback in the background thread
-    fileLoadingPool.addJob(this, false);
+    updateRemainingFrames();
+    // Schedule the file loading in the background; if the queue is full we play the preloaded data only
+    if (ioQueue.push({ SfzIORequestType::load, this }))
+    {
+        requestedChunk = 0;
+    }
+    else
+    {
+        jassertfalse;
+        dataFailed = true;
+    }
+}
+
+void SfzVoice::requestStreaming() noexcept
+{
+    if (!streaming || dataFailed)
+        return;
+
+    // Once the voice moves to a new chunk the slot of the previous one can be refilled
+    publishedPosition = sourcePosition;
+    const auto currentChunk = jmax<int64_t>(0, (sourcePosition - preloadedFrames) / chunkSize);
+    if (currentChunk > requestedChunk && ioQueue.push({ SfzIORequestType::stream, this }))
+        requestedChunk = currentChunk;
+}
+
+void SfzVoice::updateRemainingFrames() noexcept
+{
+    if (region == nullptr || !streaming || dataFailed)
+    {
+        remainingFrames = std::numeric_limits<int>::max();
+        return;
+    }
+
+    // Find the end of the data buffered ahead of the play position, in the preloaded head and the ring
+    auto chunkNumber = jmax<int64_t>(0, (sourcePosition - preloadedFrames) / chunkSize);
+    auto bufferedEnd = preloadedFrames + chunkNumber * chunkSize;
+    for (int chunkIdx = 0; chunkIdx < config::streamingChunksPerVoice; ++chunkIdx, ++chunkNumber)
+    {
+        if (streamingChunks[chunkNumber % config::streamingChunksPerVoice].chunkNumber.load(std::memory_order_acquire) != chunkNumber)
+            break;
+        bufferedEnd += chunkSize;
+    }
+
+    if (bufferedEnd >= streamLength)
+    {
+        remainingFrames = std::numeric_limits<int>::max();
+        return;
+    }
+
+    // Number of output frames we can still render from the buffered data at the current pitch
+    const auto sourceFramesLeft = jmax<int64_t>(0, bufferedEnd - sourcePosition);
+    const auto outputFramesLeft = static_cast<double>(sourceFramesLeft) / (speedRatio * pitchRatio);
+    remainingFrames = initialDelay + static_cast<int>(jmin(outputFramesLeft, static_cast<double>(std::numeric_limits<int>::max() / 2)));
+}
+
+int SfzVoice::getRemainingFrames() const noexcept
+{
+    return remainingFrames;
+}
+
+int SfzVoice::getSourceFrame(int64_t streamFrame) const noexcept
+{
+    if (streamFrame < endOrLoopEnd)
+        return static_cast<int>(streamFrame);
+
+    return loopStart + static_cast<int>((streamFrame - loopStart) % (endOrLoopEnd - loopStart));
 }
 
 void SfzVoice::registerNoteOff(int channel, int noteNumber, uint8_t velocity [[maybe_unused]], int timestamp) noexcept
@@ -171,53 +301,96 @@ void SfzVoice::registerCC(int channel, int ccNumber, uint8_t ccValue, int timest
         widthEnvelope.addEvent(timestamp, ccValue);
 }
 
-ThreadPoolJob::JobStatus SfzVoice::runJob()
+void SfzVoice::runIORequest(SfzIORequestType type)
 {
-    if (state == SfzVoiceState::idle)
-        return ThreadPoolJob::jobHasFinished;
-
-    if (region == nullptr)
-        return ThreadPoolJob::jobHasFinished;
-
-    // Normal case: the voice has ended, free up memory and reset the state
-    if (state == SfzVoiceState::release)
+    switch (type)
     {
-        reset();
-        return ThreadPoolJob::jobHasFinished;
+    case SfzIORequestType::load:
+        openStream();
+        readChunks();
+        break;
+    case SfzIORequestType::stream:
+        readChunks();
+        break;
+    case SfzIORequestType::release:
+        // Normal case: the voice has ended, free up memory; the audio thread resets the state
+        releaseResources();
+        break;
     }
-    
-    // From here on we load a sample file: generators don't need to do this.
-    if (region->isGenerator())
-        return ThreadPoolJob::jobHasFinished;
+}
 
-    // TODO: do a switch here?
-    // Normal case: we are not releasing so we are playing
-    
-    const uint32_t endOrLoopEnd = std::min(region->sampleEnd, region->loopRange.getEnd());
-    // A >2 gb sample file is a bit unreasonable, but it will cause serious issues
-    jassert(endOrLoopEnd <= std::numeric_limits<int>::max());
-    const int numSamples = static_cast<int>(endOrLoopEnd);
+void SfzVoice::openStream() noexcept
+{
+    if (state == SfzVoiceState::idle || releasePending || !streaming)
+        return;
 
-    
-    if (numSamples <= preloadedData->getNumSamples())
+    streamReader = filePool.createStreamReader(region->sample);
+    // We should not have a null reader here, something is wrong
+    if (streamReader == nullptr)
     {
-        fileData = preloadedData;
+        DBG("Could not create reader: something is wrong with the sample " << region->sample);
+        dataFailed = true;
     }
-    else
+}
+
+void SfzVoice::readChunks() noexcept
+{
+    if (state == SfzVoiceState::idle || streamReader == nullptr)
+        return;
+
+    // The chunks are split in segments that wrap around the loop, and read in as few batches as possible
+    constexpr int maxSegmentsPerRead { 16 };
+    std::array<SfzStreamReader::Segment, maxSegmentsPerRead> segments;
+    int numSegments { 0 };
+    std::array<int64_t, config::streamingChunksPerVoice> completeChunks;
+    int numCompleteChunks { 0 };
+
+    auto readSegments = [&]() {
+        if (numSegments > 0 && !streamReader->read(segments.data(), numSegments))
+        {
+            DBG("Error while streaming " << region->sample);
+            dataFailed = true;
+            return false;
+        }
+
+        numSegments = 0;
+        // Publish the chunks once all their data is there
+        for (int chunkIdx = 0; chunkIdx < numCompleteChunks; ++chunkIdx)
+        {
+            const auto chunkNumber = completeChunks[chunkIdx];
+            streamingChunks[chunkNumber % config::streamingChunksPerVoice].chunkNumber.store(chunkNumber, std::memory_order_release);
+        }
+        numCompleteChunks = 0;
+        return true;
+    };
+
+    // The voice only moves forward so the chunks before the published position are free to reuse
+    const auto firstChunk = jmax<int64_t>(0, (publishedPosition - preloadedFrames) / chunkSize);
+    for (auto chunkNumber = firstChunk; chunkNumber < firstChunk + config::streamingChunksPerVoice; ++chunkNumber)
     {
-        fileData = std::make_shared<AudioBuffer<float>>(config::numChannels, numSamples);
-        auto reader = filePool.createReaderFor(region->sample);
-        // We should not have a null reader here, something is wrong
-        if (reader == nullptr) // still null
+        const auto chunkStart = preloadedFrames + chunkNumber * chunkSize;
+        if (chunkStart >= streamLength || releasePending)
+            break;
+
+        auto& chunk = streamingChunks[chunkNumber % config::streamingChunksPerVoice];
+        if (chunk.chunkNumber.load(std::memory_order_relaxed) == chunkNumber)
+            continue;
+
+        const auto numFrames = static_cast<int>(jmin<int64_t>(chunkSize, streamLength - chunkStart));
+        for (int frameIdx = 0; frameIdx < numFrames;)
         {
-            DBG("Could not create reader: something is wrong with the sample " << region->sample);
-            return ThreadPoolJob::jobHasFinished;
+            if (numSegments == maxSegmentsPerRead && !readSegments())
+                return;
+
+            const auto sourceFrame = getSourceFrame(chunkStart + frameIdx);
+            const auto segmentLength = jmin(numFrames - frameIdx, endOrLoopEnd - sourceFrame);
+            segments[numSegments++] = { chunk.buffer, frameIdx, sourceFrame, segmentLength };
+            frameIdx += segmentLength;
         }
-        reader->read(fileData.get(), 0, numSamples, 0, true, true);
+        completeChunks[numCompleteChunks++] = chunkNumber;
     }
 
-    dataReady = true;
-    return ThreadPoolJob::jobHasFinished;
+    readSegments();
 }
 
 void SfzVoice::prepareToPlay(double newSampleRate, int newSamplesPerBlock)
@@ -225,8 +398,6 @@ void SfzVoice::prepareToPlay(double newSampleRate, int newSamplesPerBlock)
     this->sampleRate = newSampleRate;
     this->samplesPerBlock = newSamplesPerBlock;
     amplitudeEGEnvelope.setSampleRate(newSampleRate);
-    tempBlock1 = dsp::AudioBlock<float>(tempHeapBlock1, config::numChannels, newSamplesPerBlock);
-    tempBlock2 = dsp::AudioBlock<float>(tempHeapBlock2, config::numChannels, newSamplesPerBlock);
     amplitudeEnvelope.reserve(newSamplesPerBlock);
     panEnvelope.reserve(newSamplesPerBlock);
     positionEnvelope.reserve(newSamplesPerBlock);
@@ -245,22 +416,70 @@ bool SfzVoice::checkOffGroup(uint32_t group, int timestamp) noexcept
     return false;
 }
 
-void SfzVoice::fillGenerator(dsp::AudioBlock<float> block) noexcept
+void SfzVoice::chooseFillFunction() noexcept
 {
-    if (region->sample == "*silence")
+    if (region->isGenerator())
+    {
+        fillFunction = region->sample == "*sine" ? &SfzVoice::fillSine : &SfzVoice::fillSilence;
+        return;
+    }
+
+    if (preloadedData == nullptr)
     {
-        block.clear();
+        fillFunction = &SfzVoice::fillWithoutSampleData;
+        return;
     }
-    else if (region->sample == "*sine")
+
+    auto frameLookup = FrameLookup::direct;
+    if (streaming)
+        frameLookup = FrameLookup::streamed;
+    else if (streamLength > endOrLoopEnd)
+        frameLookup = FrameLookup::looped;
+
+    if (region->numChannels == 1)
+        fillFunction = getSampleFillFunction<1>(frameLookup);
+    else
+        fillFunction = getSampleFillFunction<2>(frameLookup);
+}
+
+template<int NumSourceChannels>
+SfzVoice::FillFunction SfzVoice::getSampleFillFunction(FrameLookup frameLookup) noexcept
+{
+    switch (frameLookup)
     {
-        const auto frequency = MathConstants<float>::twoPi * MidiMessage::getMidiNoteInHertz(region->pitchKeycenter) * pitchRatio;
+    case FrameLookup::looped:
+        return &SfzVoice::fillWithSampleData<NumSourceChannels, FrameLookup::looped>;
+    case FrameLookup::streamed:
+        return &SfzVoice::fillWithSampleData<NumSourceChannels, FrameLookup::streamed>;
+    case FrameLookup::direct:
+    default:
+        return &SfzVoice::fillWithSampleData<NumSourceChannels, FrameLookup::direct>;
+    }
+}
+
+void SfzVoice::fillSilence(dsp::AudioBlock<float> block, int releaseOffset [[maybe_unused]]) noexcept
+{
+    block.clear();
+}
+
+void SfzVoice::fillSine(dsp::AudioBlock<float> block, int releaseOffset [[maybe_unused]]) noexcept
+{
+    const auto frequency = MathConstants<float>::twoPi * MidiMessage::getMidiNoteInHertz(region->pitchKeycenter) * pitchRatio;
 
-        for (int chanIdx = 0; chanIdx < config::numChannels; chanIdx++)
-            for(int sampleIdx = 0; sampleIdx < block.getNumSamples(); sampleIdx++)
-                block.setSample(chanIdx, sampleIdx, static_cast<float>(std::sin(frequency * sourcePosition++ / sampleRate)));
+    for (size_t sampleIdx = 0; sampleIdx < block.getNumSamples(); sampleIdx++)
+    {
+        const auto value = static_cast<float>(std::sin(frequency * sourcePosition++ / sampleRate));
+        for (size_t chanIdx = 0; chanIdx < block.getNumChannels(); chanIdx++)
+            block.setSample(static_cast<int>(chanIdx), static_cast<int>(sampleIdx), value);
     }
 }
 
+void SfzVoice::fillWithoutSampleData(dsp::AudioBlock<float> block, int releaseOffset) noexcept
+{
+    block.clear();
+    release(releaseOffset);
+}
+
 void SfzVoice::fillBlock(dsp::AudioBlock<float> block) noexcept
 {
     const auto samplesToClear = std::min(initialDelay, (int)block.getNumSamples());
@@ -275,135 +494,215 @@ void SfzVoice::fillBlock(dsp::AudioBlock<float> block) noexcept
             block = block.getSubBlock(samplesToClear);
     }
 
-    if (region->isGenerator())
-        fillGenerator(block);
-    else if (dataReady)
-        fillWithFileData(block, samplesToClear);
-    else
-        fillWithPreloadedData(block, samplesToClear);
+    (this->*fillFunction)(block, samplesToClear);
 }
 
-void SfzVoice::fillWithFileData(dsp::AudioBlock<float> block, int releaseOffset) noexcept
+void SfzVoice::applyFade(dsp::AudioBlock<float> block, float startGain, float endGain) noexcept
 {
-    auto nextPositionBlock = tempBlock1.getSubBlock(0, block.getNumSamples());
-    auto interpolationBlock = tempBlock2.getSubBlock(0, block.getNumSamples());
-    int nextPosition { 0 };
-    const int lastSample { fileData->getNumSamples() - 1 };
- 
-    for (auto sampleIdx = 0; sampleIdx < block.getNumSamples(); ++sampleIdx)
+    const auto numSamples = static_cast<int>(block.getNumSamples());
+    if (numSamples == 0)
+        return;
+
+    const auto step = (endGain - startGain) / numSamples;
+    for (size_t chanIdx = 0; chanIdx < block.getNumChannels(); ++chanIdx)
     {
-        if (sourcePosition > lastSample)
-        {
-            const int overflow { sourcePosition - lastSample - 1};
-            if (region->shouldLoop())
-            {
-                sourcePosition = region->loopRange.getStart() + overflow;
-                nextPosition = sourcePosition + 1;
-            }
-            else if (region->sampleCount && loopCount < *region->sampleCount)
-            {
-                // We're looping and counting, restart the source position
-                loopCount += 1;
-                sourcePosition = region->loopRange.getStart() + overflow;
-                nextPosition = sourcePosition + 1;
-            }
-            else
-            {
-                block.getSubBlock(sampleIdx).clear();
-                nextPositionBlock.getSubBlock(sampleIdx).clear();
-                interpolationBlock.getSubBlock(sampleIdx).clear();
-                release(sampleIdx + releaseOffset);
-                break;
-            }
-        }
-        else if (sourcePosition == lastSample)
-        {
-            if (region->shouldLoop())
-            {
-                nextPosition = region->loopRange.getStart();
-            }
-            else if (region->sampleCount && loopCount < *region->sampleCount)
-            {
-                loopCount += 1;
-                nextPosition = region->loopRange.getStart();
-            }
-            else
-            {
-                block.getSubBlock(sampleIdx).clear();
-                nextPositionBlock.getSubBlock(sampleIdx).clear();
-                interpolationBlock.getSubBlock(sampleIdx).clear();
-                release(sampleIdx + releaseOffset);
-                return;
-            }
-        }
-        else
+        auto* channel = block.getChannelPointer(chanIdx);
+        auto gain = startGain;
+        for (int sampleIdx = 0; sampleIdx < numSamples; ++sampleIdx)
         {
-            nextPosition = sourcePosition + 1;
+            channel[sampleIdx] *= gain;
+            gain += step;
         }
+    }
+}
 
-        for (auto chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+void SfzVoice::registerUnderrun(dsp::AudioBlock<float> block, int starvedFrom) noexcept
+{
+    if (!starving)
+    {
+        // Fade out what we could render before running out of data instead of cutting it
+        const auto fadeLength = jmin(config::underrunFadeLength, starvedFrom);
+        applyFade(block.getSubBlock(starvedFrom - fadeLength, fadeLength), 1.0f, 0.0f);
+        filePool.registerUnderrun(sampleStatistics);
+        starving = true;
+    }
+
+    filePool.registerStarvedFrames(sampleStatistics, static_cast<int>(block.getNumSamples()) - starvedFrom);
+}
+
+template<SfzVoice::FrameLookup Lookup>
+const AudioBuffer<float>* SfzVoice::locateFrame(int64_t streamFrame, int& frameIndex, int64_t& runEnd) const noexcept
+{
+    if constexpr (Lookup == FrameLookup::streamed)
+    {
+        if (streamFrame >= preloadedFrames)
         {
-            block.setSample(chanIdx, sampleIdx, fileData->getSample(chanIdx, sourcePosition));
-            nextPositionBlock.setSample(chanIdx, sampleIdx, fileData->getSample(chanIdx, nextPosition));
-            interpolationBlock.setSample(chanIdx, sampleIdx, decimalPosition);
+            const auto chunkNumber = (streamFrame - preloadedFrames) / chunkSize;
+            const auto& chunk = streamingChunks[chunkNumber % config::streamingChunksPerVoice];
+            if (chunk.chunkNumber.load(std::memory_order_acquire) != chunkNumber)
+                return nullptr;
+
+            frameIndex = static_cast<int>(streamFrame - preloadedFrames - chunkNumber * chunkSize);
+            runEnd = preloadedFrames + (chunkNumber + 1) * chunkSize;
+            return chunk.buffer;
         }
 
-        decimalPosition += speedRatio * pitchRatio;
-        const auto sampleStep = static_cast<int>(decimalPosition);
-        sourcePosition += sampleStep;
-        decimalPosition -= sampleStep;
+        // The preloaded head of a streamed sample ends before the loop does
+        frameIndex = static_cast<int>(streamFrame);
+        runEnd = preloadedFrames;
     }
-
-    nextPositionBlock.multiply(interpolationBlock);
-    interpolationBlock.negate().add(1.0f);
-    block.multiply(interpolationBlock).add(nextPositionBlock);
+    else if constexpr (Lookup == FrameLookup::looped)
+    {
+        frameIndex = getSourceFrame(streamFrame);
+        runEnd = streamFrame + endOrLoopEnd - frameIndex;
+    }
+    else
+    {
+        frameIndex = static_cast<int>(streamFrame);
+        runEnd = endOrLoopEnd;
+    }
+    return preloadedData;
 }
 
-void SfzVoice::fillWithPreloadedData(dsp::AudioBlock<float> block, int releaseOffset) noexcept
+template<int NumSourceChannels, SfzVoice::FrameLookup Lookup>
+void SfzVoice::fillWithSampleData(dsp::AudioBlock<float> block, int releaseOffset) noexcept
 {
     auto nextPositionBlock = tempBlock1.getSubBlock(0, block.getNumSamples());
     auto interpolationBlock = tempBlock2.getSubBlock(0, block.getNumSamples());
-    int nextPosition { 0 };
+    const auto numSamples = static_cast<int>(block.getNumSamples());
+    const auto step = speedRatio * pitchRatio;
+    int starvedFrom { -1 };
 
-    const auto endOrLoopEnd = static_cast<int>(jmin(region->sampleEnd, region->loopRange.getEnd()));
-    const auto lastValidSample = jmin(preloadedData->getNumSamples(), endOrLoopEnd) - 1;
-    for (auto sampleIdx = 0; sampleIdx < block.getNumSamples(); ++sampleIdx)
+    // After an underrun the voice holds its position until the data covers a whole block
+    if constexpr (Lookup == FrameLookup::streamed)
     {
-        // We need these because the preloaded data may be reused for multiple samples...
-        if ( sourcePosition >= lastValidSample)
+        if (starving && !isBuffered(numSamples))
+        {
+            block.clear();
+            filePool.registerStarvedFrames(sampleStatistics, numSamples);
+            return;
+        }
+    }
+
+    auto advance = [this, step]() {
+        decimalPosition += step;
+        const auto sampleStep = static_cast<int>(decimalPosition);
+        sourcePosition += sampleStep;
+        decimalPosition -= sampleStep;
+    };
+
+    for (auto sampleIdx = 0; sampleIdx < numSamples;)
+    {
+        const bool endReached { sourcePosition + 1 >= streamLength };
+        int currentIndex { 0 };
+        int64_t runEnd { 0 };
+        const auto* currentData = endReached ? nullptr : locateFrame<Lookup>(sourcePosition, currentIndex, runEnd);
+
+        // Both frames are in the same run of data up to the end of the run or of the
+        // stream; render the output frames that stay there without checking for it,
+        // keeping a margin of one step for the rounding of the position
+        const auto sourceFramesLeft = currentData == nullptr ? 0 : jmin(runEnd, streamLength) - 1 - sourcePosition;
+        const auto runFrames = sourceFramesLeft <= 0 ? 0
+            : static_cast<int>(jlimit(0.0, static_cast<double>(numSamples - sampleIdx), (sourceFramesLeft - decimalPosition) / static_cast<double>(step)));
+        if (runFrames > 0)
+        {
+            const float* channels[NumSourceChannels];
+            for (int channelIdx = 0; channelIdx < NumSourceChannels; ++channelIdx)
+                channels[channelIdx] = currentData->getReadPointer(channelIdx, currentIndex);
+
+            const auto runStart = sourcePosition;
+            for (const auto runStop = sampleIdx + runFrames; sampleIdx < runStop; ++sampleIdx)
+            {
+                const auto offset = static_cast<int>(sourcePosition - runStart);
+                for (auto chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+                {
+                    // Mono samples play their only channel on all the outputs
+                    const auto* data = channels[jmin(chanIdx, NumSourceChannels - 1)];
+                    block.setSample(chanIdx, sampleIdx, data[offset]);
+                    nextPositionBlock.setSample(chanIdx, sampleIdx, data[offset + 1]);
+                    interpolationBlock.setSample(chanIdx, sampleIdx, decimalPosition);
+                }
+                advance();
+            }
+            continue;
+        }
+
+        // The frame is on a boundary: past the end, across the loop or a chunk edge, or its data is missing
+        int nextIndex { 0 };
+        int64_t nextRunEnd { 0 };
+        const auto* nextData = currentData == nullptr ? nullptr : locateFrame<Lookup>(sourcePosition + 1, nextIndex, nextRunEnd);
+        if (nextData == nullptr)
         {
             block.getSubBlock(sampleIdx).clear();
             nextPositionBlock.getSubBlock(sampleIdx).clear();
             interpolationBlock.getSubBlock(sampleIdx).clear();
-            // TODO: do we release here?
-            release(sampleIdx + releaseOffset);
+            // If the data is late, hold the position and output silence until it is there
+            if (endReached || dataFailed)
+                release(sampleIdx + releaseOffset);
+            else
+                starvedFrom = sampleIdx;
             break;
         }
 
-        nextPosition = sourcePosition + 1;
         for (auto chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
         {
-            block.setSample(chanIdx, sampleIdx, preloadedData->getSample(chanIdx, sourcePosition));
-            nextPositionBlock.setSample(chanIdx, sampleIdx, preloadedData->getSample(chanIdx, nextPosition));
+            const auto sourceChannel = jmin(chanIdx, NumSourceChannels - 1);
+            block.setSample(chanIdx, sampleIdx, currentData->getSample(sourceChannel, currentIndex));
+            nextPositionBlock.setSample(chanIdx, sampleIdx, nextData->getSample(sourceChannel, nextIndex));
             interpolationBlock.setSample(chanIdx, sampleIdx, decimalPosition);
         }
-        
-        decimalPosition += speedRatio * pitchRatio;
-        const auto sampleStep = static_cast<int>(decimalPosition);
-        sourcePosition += sampleStep;
-        decimalPosition -= sampleStep;
+        advance();
+        ++sampleIdx;
     }
 
     nextPositionBlock.multiply(interpolationBlock);
     interpolationBlock.negate().add(1.0f);
     block.multiply(interpolationBlock).add(nextPositionBlock);
+
+    if (starving && starvedFrom != 0)
+    {
+        // The data came back after an underrun: fade in from where we stopped
+        const auto renderedFrames = starvedFrom < 0 ? block.getNumSamples() : static_cast<size_t>(starvedFrom);
+        applyFade(block.getSubBlock(0, jmin(static_cast<size_t>(config::underrunFadeLength), renderedFrames)), 0.0f, 1.0f);
+        starving = false;
+    }
+
+    if (starvedFrom >= 0)
+    {
+        registerUnderrun(block, starvedFrom);
+        return;
+    }
+
+    if constexpr (Lookup == FrameLookup::streamed)
+    {
+        // Fade out at the end of this block if the data will not cover the next one,
+        // rather than cutting the voice at the start of the next one
+        if (!starving && !isBuffered(config::renderQuantum))
+        {
+            const auto fadeLength = jmin(config::underrunFadeLength, numSamples);
+            applyFade(block.getSubBlock(numSamples - fadeLength, fadeLength), 1.0f, 0.0f);
+            filePool.registerUnderrun(sampleStatistics);
+            starving = true;
+        }
+    }
 }
 
+bool SfzVoice::isBuffered(int numFrames) noexcept
+{
+    updateRemainingFrames();
+    return remainingFrames.load(std::memory_order_relaxed) >= numFrames;
+}
 
 void SfzVoice::renderNextBlock(AudioBuffer<float>& outputBuffer, int startSample, int numSamples) noexcept
 {
+    jassert(numSamples <= config::renderQuantum);
     auto outputBlock = dsp::AudioBlock<float>(outputBuffer).getSubBlock(startSample, numSamples);
-    if (!isPlaying() || region == nullptr)
+    // Once the release request is sent the buffers of the voice belong to the I/O thread,
+    // which reports back when it is done with them
+    if (releasePending && releaseDone.load(std::memory_order_acquire))
+        finishRelease();
+
+    if (!isPlaying() || region == nullptr || releasePending)
     {
         outputBlock.clear();
         return;
@@ -411,10 +710,10 @@ void SfzVoice::renderNextBlock(AudioBuffer<float>& outputBuffer, int startSample
     
     fillBlock(outputBlock);
     // Amplitude EG envelopes
-    for (int sampleIdx = startSample; sampleIdx < numSamples; sampleIdx++)
+    for (int sampleIdx = startSample; sampleIdx < startSample + numSamples; sampleIdx++)
         outputBuffer.applyGain(sampleIdx, 1, amplitudeEGEnvelope.getNextValue());
     
-    auto localEnvelopeBuffer = tempBlock1.getSubBlock(startSample, numSamples);
+    auto localEnvelopeBuffer = tempBlock1.getSubBlock(0, numSamples);
     if (region->amplitudeCC)
     {
         amplitudeEnvelope.getEnvelope(localEnvelopeBuffer);
@@ -425,23 +724,53 @@ void SfzVoice::renderNextBlock(AudioBuffer<float>& outputBuffer, int startSample
         outputBlock.multiply(baseGain);
     }
 
-    if (state == SfzVoiceState::release && !amplitudeEGEnvelope.isSmoothing() && !fileLoadingPool.contains(this))
-        fileLoadingPool.addJob(this, false);
+    requestStreaming();
+    updateRemainingFrames();
+
+    if (state == SfzVoiceState::release && !amplitudeEGEnvelope.isSmoothing())
+    {
+        // Set the flag before the push: the I/O thread may serve the request right away
+        releasePending = true;
+        if (!ioQueue.push({ SfzIORequestType::release, this }))
+            releasePending = false;
+    }
 }
 
 void SfzVoice::reset() noexcept
 {
-    state = SfzVoiceState::idle;
+    releaseResources();
+    finishRelease();
+}
+
+void SfzVoice::releaseResources() noexcept
+{
+    // The garbage collector frees the preloaded data in the background, if it was replaced in the meantime
+    preloadedData = nullptr;
+    SfzFilePool::releasePreloadedData(preloadHazard);
+    releaseStream();
+    streamReader.reset();
+    releaseDone.store(true, std::memory_order_release);
+}
+
+void SfzVoice::finishRelease() noexcept
+{
     region = nullptr;
     triggeringNoteNumber.reset();
     triggeringCCNumber.reset();
     triggeringChannel.reset();
-    dataReady = false;
-    fileData.reset();
-    preloadedData.reset();
+    dataFailed = false;
+    starving = false;
+    sampleStatistics = nullptr;
+    requestedChunk = -1;
+    publishedPosition = 0;
     initialDelay = 0;
     sourcePosition = 0;
     decimalPosition = 0;
+    fillFunction = &SfzVoice::fillSilence;
+    releasePending = false;
+    releaseDone = false;
+    remainingFrames = std::numeric_limits<int>::max();
+    state = SfzVoiceState::idle;
 }
 
 std::optional<int> SfzVoice::getTriggeringNoteNumber() const noexcept
@@ -27,7 +27,9 @@
 #include "SfzEnvelope.h"
 #include "Buffer.h"
 #include "SfzBlockEnvelope.h"
-#include <future>
+#include "SfzIOQueue.h"
+#include <atomic>
+#include <array>
 
 enum class SfzVoiceState
 {
@@ -36,16 +38,17 @@ enum class SfzVoiceState
     release
 };
 
-class SfzVoice: public ThreadPoolJob 
+class SfzVoice: public SfzIOJob
 {
 public:
     SfzVoice() = delete;
-    SfzVoice(ThreadPool& fileLoadingPool, SfzFilePool& filePool, const CCValueArray& ccState);
-    ~SfzVoice() noexcept;
+    SfzVoice(SfzIOQueue& ioQueue, SfzFilePool& filePool, const CCValueArray& ccState, SfzRandom& random);
+    ~SfzVoice();
     
     void startVoiceWithNote(SfzRegion& newRegion, int channel, int noteNumber, uint8_t velocity, int sampleDelay) noexcept;
     void startVoiceWithCC(SfzRegion& newRegion, int channel, int ccNumber, uint8_t ccValue, int sampleDelay) noexcept;
     void prepareToPlay(double sampleRate, int samplesPerBlock);
+    // Render at most config::renderQuantum frames; the timestamps of the events are relative to the next call
     void renderNextBlock(AudioBuffer<float>& outputBuffer, int startSample, int numSamples) noexcept;
 
     void registerAftertouch(int channel, uint8_t aftertouch, int timestamp) noexcept;
@@ -54,6 +57,7 @@ public:
     void registerCC(int channel, int ccNumber, uint8_t ccValue, int timestamp) noexcept;
     bool checkOffGroup(uint32_t group, int timestamp) noexcept;
 
+    // Give back the buffers and clear the voice; only while the I/O threads are stopped
     void reset() noexcept;
     bool isFree() const { return state == SfzVoiceState::idle; }
     bool isPlaying() const { return state != SfzVoiceState::idle; }
@@ -61,19 +65,50 @@ public:
     std::optional<int> getTriggeringChannel() const noexcept;
     std::optional<int> getTriggeringNoteNumber() const noexcept;
     std::optional<int> getTriggeringCCNumber() const noexcept;
+    // Output frames the voice can still render from its buffered data before it starves
+    int getRemainingFrames() const noexcept override;
+    // Source frame played at a position of the stream, where the loops are unrolled
+    int getSourceFrame(int64_t streamFrame) const noexcept;
 private:
-    ThreadPool& fileLoadingPool;
+    SfzIOQueue& ioQueue;
     SfzFilePool& filePool;
     const CCValueArray& ccState;
+    SfzRandom& random; // Shared with the synth, see SfzRandom
 
     // Message and region that activated the note
     std::optional<int> triggeringChannel;
     std::optional<int> triggeringNoteNumber;
     std::optional<int> triggeringCCNumber;
     SfzRegion* region { nullptr };
-    std::shared_ptr<AudioBuffer<float>> preloadedData { nullptr };
-    std::shared_ptr<AudioBuffer<float>> fileData { nullptr };
-    std::atomic<bool> dataReady;
+    AudioBuffer<float>* preloadedData { nullptr };
+    SfzFilePool::PreloadHazard preloadHazard { nullptr }; // Keeps preloadedData alive, see SfzFilePool::getPreloadedData()
+    std::atomic<bool> dataFailed { false };
+    bool starving { false };
+    SfzSampleStatistics* sampleStatistics { nullptr };
+    // Set by the audio thread when it sends the release request, and by the I/O thread once it gave the buffers back
+    std::atomic<bool> releasePending { false };
+    std::atomic<bool> releaseDone { false };
+    std::atomic<int> remainingFrames { std::numeric_limits<int>::max() };
+
+    // Streaming: the part of the sample past the preloaded head is read in a
+    // ring of chunks borrowed from the file pool. Positions are counted in
+    // stream frames, i.e. with the loops unrolled, and chunk n of the stream
+    // lives in the ring slot n % streamingChunksPerVoice.
+    struct StreamingChunk
+    {
+        AudioBuffer<float>* buffer { nullptr };
+        std::atomic<int64_t> chunkNumber { -1 }; // chunk of the stream held in the buffer, -1 if none
+    };
+    std::array<StreamingChunk, config::streamingChunksPerVoice> streamingChunks;
+    std::unique_ptr<SfzStreamReader> streamReader;
+    bool streaming { false };
+    int chunkSize { 0 };
+    int preloadedFrames { 0 };
+    int endOrLoopEnd { 0 };
+    int loopStart { 0 };
+    int64_t streamLength { 0 };
+    int64_t requestedChunk { -1 };
+    std::atomic<int64_t> publishedPosition { 0 };
 
     // Sustain logic
     bool noteIsOff { true };
@@ -86,7 +121,7 @@ private:
     float speedRatio { 1.0 };
     float pitchRatio { 1.0 };
     // Envelopes and states for the voice
-    SfzVoiceState state { SfzVoiceState::idle };
+    std::atomic<SfzVoiceState> state { SfzVoiceState::idle };
     float baseGain { 1.0f };
 
     SfzEnvelopeGeneratorValue amplitudeEGEnvelope;
@@ -102,18 +137,44 @@ private:
 
     // Internal position and counters
     int initialDelay { 0 };
-    int sourcePosition { 0 };
-    uint32_t loopCount { 1 };
+    int64_t sourcePosition { 0 };
 
     float decimalPosition { 0.0f };
 
-    JobStatus runJob() override;
+    void runIORequest(SfzIORequestType type) override;
+    void openStream() noexcept;
+    void readChunks() noexcept;
     void clearEnvelopes() noexcept;
     void release(int timestamp, bool useFastRelease = false) noexcept;
     void fillBlock(dsp::AudioBlock<float> block) noexcept;
-    void fillGenerator(dsp::AudioBlock<float> block) noexcept;
-    void fillWithPreloadedData(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
-    void fillWithFileData(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+
+    // The voice renders its source through a fill function chosen when it starts, with
+    // the invariants of the region (channels, loop, streaming) fixed at compile time
+    enum class FrameLookup { direct, looped, streamed };
+    using FillFunction = void (SfzVoice::*)(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+    FillFunction fillFunction { &SfzVoice::fillSilence };
+    void chooseFillFunction() noexcept;
+    template<int NumSourceChannels>
+    static FillFunction getSampleFillFunction(FrameLookup frameLookup) noexcept;
+    void fillSilence(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+    void fillSine(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+    void fillWithoutSampleData(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+    template<int NumSourceChannels, FrameLookup Lookup>
+    void fillWithSampleData(dsp::AudioBlock<float> block, int releaseOffset) noexcept;
+    // Data of a stream frame, and the end of the run of stream frames that follow it contiguously in that data
+    template<FrameLookup Lookup>
+    const AudioBuffer<float>* locateFrame(int64_t streamFrame, int& frameIndex, int64_t& runEnd) const noexcept;
+    void applyFade(dsp::AudioBlock<float> block, float startGain, float endGain) noexcept;
+    void registerUnderrun(dsp::AudioBlock<float> block, int starvedFrom) noexcept;
+    // Whether the buffered data covers the next output frames
+    bool isBuffered(int numFrames) noexcept;
     void commonStartVoice(SfzRegion& newRegion, int sampleDelay) noexcept;
+    void setupStream() noexcept;
+    void releaseStream() noexcept;
+    void releaseResources() noexcept;
+    void finishRelease() noexcept;
+    void scheduleFileLoading() noexcept;
+    void requestStreaming() noexcept;
+    void updateRemainingFrames() noexcept;
     JUCE_LEAK_DETECTOR(SfzVoice)
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzSynth.h"
+#include <filesystem>
+
+namespace
+{
+    template<class Predicate>
+    bool waitFor(Predicate predicate, int timeoutInMilliseconds = 5000)
+    {
+        const auto start = Time::getMillisecondCounter();
+        while (!predicate())
+        {
+            if (Time::getMillisecondCounter() - start > static_cast<uint32>(timeoutInMilliseconds))
+                return false;
+            Thread::sleep(5);
+        }
+        return true;
+    }
+
+    const auto articulations = std::filesystem::current_path() / "Tests/TestFiles/SpecificBugs/MeatBassPizz/Programs/articulations.sfz";
+}
+
+TEST_CASE("Articulation loading", "Articulation loader tests")
+{
+    SECTION("Eager loading does not defer anything")
+    {
+        SfzSynth synth;
+        REQUIRE( synth.loadSfzFile(articulations) );
+        REQUIRE( synth.getNumLazyArticulations() == 0 );
+    }
+
+    SECTION("Articulations are loaded on selection")
+    {
+        SfzSynth synth;
+        synth.setArticulationLoading(SfzArticulationLoading::onSelection);
+        REQUIRE( synth.loadSfzFile(articulations) );
+        REQUIRE( synth.getNumRegions() == 4 );
+        REQUIRE( synth.getNumLazyArticulations() == 2 );
+        REQUIRE( synth.getNumLoadedLazyArticulations() == 0 );
+
+        synth.registerNoteOn(1, 41, 127, 0);
+        REQUIRE( waitFor([&]() { return synth.getNumLoadedLazyArticulations() == 1; }) );
+        Thread::sleep(100);
+        REQUIRE( synth.getNumLoadedLazyArticulations() == 1 );
+    }
+
+    SECTION("Articulations are loaded in the background")
+    {
+        SfzSynth synth;
+        synth.setArticulationLoading(SfzArticulationLoading::background);
+        REQUIRE( synth.loadSfzFile(articulations) );
+        REQUIRE( waitFor([&]() { return synth.getNumLoadedLazyArticulations() == 2; }) );
+    }
+
+    SECTION("Unused articulations are released")
+    {
+        SfzSynth synth;
+        synth.setArticulationLoading(SfzArticulationLoading::onSelection, 0.1);
+        REQUIRE( synth.loadSfzFile(articulations) );
+        synth.registerNoteOn(1, 41, 127, 0);
+        REQUIRE( waitFor([&]() { return synth.getNumLoadedLazyArticulations() == 1; }) );
+
+        // Still selected, so it stays
+        Thread::sleep(300);
+        REQUIRE( synth.getNumLoadedLazyArticulations() == 1 );
+
+        synth.registerNoteOn(1, 40, 127, 0);
+        REQUIRE( waitFor([&]() { return synth.getNumLoadedLazyArticulations() == 0; }) );
+    }
+}
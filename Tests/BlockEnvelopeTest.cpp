@@ -109,7 +109,21 @@ TEST_CASE("BlockEnvelope Tests", "BlockEnvelope Tests")
         std::array<float, numElements> expected { 0.0f, 1.0f, 2.0f, 3.0f };
         REQUIRE( output == expected );
         envelope.getEnvelope(output.data(), numElements);
-        std::array<float, numElements> expected2 { 3.0f, 3.0f, 3.0f, 3.0f };
+        std::array<float, numElements> expected2 { 4.0f, 4.0f, 4.0f, 4.0f };
+        REQUIRE( output == expected2 );
+    }
+
+    SECTION("Events past the block")
+    {
+        constexpr int numElements { 4 };
+        SfzBlockEnvelope<float> envelope { 2 * numElements, 0.0f };
+        std::array<float, numElements> output;
+        envelope.addEvent(6, 6);
+        envelope.getEnvelope(output.data(), numElements);
+        std::array<float, numElements> expected { 0.0f, 1.0f, 2.0f, 3.0f };
+        REQUIRE( output == expected );
+        envelope.getEnvelope(output.data(), numElements);
+        std::array<float, numElements> expected2 { 4.0f, 5.0f, 6.0f, 6.0f };
         REQUIRE( output == expected2 );
     }
 
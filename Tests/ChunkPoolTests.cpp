@@ -0,0 +1,65 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzChunkPool.h"
+#include <set>
+
+TEST_CASE("Chunk pool", "Chunk pool tests")
+{
+    SECTION("Empty pool")
+    {
+        SfzChunkPool pool;
+        REQUIRE( pool.getNumChunks() == 0 );
+        REQUIRE( pool.acquire() == nullptr );
+    }
+
+    SECTION("Chunk sizes")
+    {
+        SfzChunkPool pool;
+        pool.allocate(4, 256);
+        REQUIRE( pool.getNumChunks() == 4 );
+        REQUIRE( pool.getNumFreeChunks() == 4 );
+        REQUIRE( pool.getChunkSize() == 256 );
+        auto* chunk = pool.acquire();
+        REQUIRE( chunk != nullptr );
+        REQUIRE( chunk->getNumChannels() == config::numChannels );
+        REQUIRE( chunk->getNumSamples() == 256 );
+        pool.release(chunk);
+    }
+
+    SECTION("Borrow all the chunks and give them back")
+    {
+        SfzChunkPool pool;
+        pool.allocate(3, 64);
+        std::set<AudioBuffer<float>*> borrowed;
+        for (int chunkIdx = 0; chunkIdx < 3; ++chunkIdx)
+            borrowed.insert(pool.acquire());
+        REQUIRE( borrowed.size() == 3 );
+        REQUIRE( borrowed.count(nullptr) == 0 );
+        REQUIRE( pool.acquire() == nullptr );
+        REQUIRE( pool.getNumFreeChunks() == 0 );
+
+        auto* chunk = *borrowed.begin();
+        pool.release(chunk);
+        REQUIRE( chunk == nullptr );
+        REQUIRE( pool.getNumFreeChunks() == 1 );
+        REQUIRE( pool.acquire() == *borrowed.begin() );
+    }
+
+    SECTION("Chunks do not overlap")
+    {
+        SfzChunkPool pool;
+        pool.allocate(2, 16);
+        auto* first = pool.acquire();
+        auto* second = pool.acquire();
+        first->clear();
+        second->clear();
+        for (int chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+            for (int sampleIdx = 0; sampleIdx < 16; ++sampleIdx)
+                first->setSample(chanIdx, sampleIdx, 1.0f);
+        for (int chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+            for (int sampleIdx = 0; sampleIdx < 16; ++sampleIdx)
+                REQUIRE( second->getSample(chanIdx, sampleIdx) == 0.0f );
+        pool.release(first);
+        pool.release(second);
+    }
+}
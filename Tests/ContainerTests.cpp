@@ -0,0 +1,56 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzContainer.h"
+#include <vector>
+
+TEST_CASE("CC container", "Container tests")
+{
+    SfzContainer<Range<uint8_t>> container { Range<uint8_t>(0, 127) };
+
+    SECTION("Defaults")
+    {
+        REQUIRE( container.empty() );
+        REQUIRE( !container.contains(0) );
+        REQUIRE( !container.contains(127) );
+        REQUIRE( !container.contains(-1) );
+        REQUIRE( !container.contains(128) );
+        REQUIRE( container.getWithDefault(64) == Range<uint8_t>(0, 127) );
+        REQUIRE( container.getWithDefault(200) == Range<uint8_t>(0, 127) );
+        REQUIRE_THROWS( container.at(64) );
+    }
+
+    SECTION("Set values")
+    {
+        container[64].setStart(10);
+        container[1].setEnd(20);
+        container[127].setStart(30);
+        container[70] = Range<uint8_t>(5, 6);
+        container[64].setEnd(100);
+        REQUIRE( container.size() == 4 );
+        REQUIRE( container.contains(1) );
+        REQUIRE( container.contains(64) );
+        REQUIRE( container.contains(70) );
+        REQUIRE( container.contains(127) );
+        REQUIRE( !container.contains(63) );
+        REQUIRE( !container.contains(65) );
+        REQUIRE( container.at(1) == Range<uint8_t>(0, 20) );
+        REQUIRE( container.at(64) == Range<uint8_t>(10, 100) );
+        REQUIRE( container.getWithDefault(70) == Range<uint8_t>(5, 6) );
+        REQUIRE( container.getWithDefault(127) == Range<uint8_t>(30, 127) );
+        REQUIRE( container.getWithDefault(2) == Range<uint8_t>(0, 127) );
+    }
+
+    SECTION("Iteration goes over the set keys in order")
+    {
+        for (int key: { 100, 3, 65, 63, 0 })
+            container[key] = Range<uint8_t>(static_cast<uint8_t>(key), 127);
+
+        std::vector<int> keys;
+        for (const auto& value: container)
+        {
+            REQUIRE( value.second.getStart() == value.first );
+            keys.push_back(value.first);
+        }
+        REQUIRE( keys == std::vector<int> { 0, 3, 63, 65, 100 } );
+    }
+}
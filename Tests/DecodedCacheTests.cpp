@@ -0,0 +1,85 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzDecodedCache.h"
+#include <filesystem>
+
+TEST_CASE("Decoded cache", "Decoded cache tests")
+{
+    const File samples { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/SpecificBugs/MeatBassPizz/Samples/pizz" };
+    const auto cacheDirectory = File::getSpecialLocation(File::tempDirectory).getChildFile("SfzDecodedCacheTests");
+    cacheDirectory.deleteRecursively();
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    SECTION("Compressed formats")
+    {
+        REQUIRE( SfzDecodedCache::isCompressed(File("/some/sample.flac")) );
+        REQUIRE( SfzDecodedCache::isCompressed(File("/some/sample.ogg")) );
+        REQUIRE( !SfzDecodedCache::isCompressed(File("/some/sample.wav")) );
+    }
+
+    SECTION("Entries are decoded once and reused")
+    {
+        SfzDecodedCache cache { cacheDirectory };
+        const auto entry = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager);
+        REQUIRE( entry.existsAsFile() );
+        REQUIRE( entry.getParentDirectory() == cacheDirectory );
+        const auto modificationTime = entry.getLastModificationTime();
+        REQUIRE( cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager) == entry );
+        REQUIRE( entry.getLastModificationTime() == modificationTime );
+
+        std::unique_ptr<AudioFormatReader> original { formatManager.createReaderFor(samples.getChildFile("a0_vl4_rr1.wav")) };
+        std::unique_ptr<AudioFormatReader> decoded { formatManager.createReaderFor(entry) };
+        REQUIRE( decoded != nullptr );
+        REQUIRE( decoded->usesFloatingPointData );
+        REQUIRE( decoded->lengthInSamples == original->lengthInSamples );
+    }
+
+    SECTION("Eviction keeps the entries in use")
+    {
+        SfzDecodedCache cache { cacheDirectory, 1, RelativeTime() };
+        const auto first = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager);
+        const auto second = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr2.wav"), formatManager);
+        cache.finishLoading();
+        REQUIRE( first.existsAsFile() );
+        REQUIRE( second.existsAsFile() );
+
+        cache.releaseEntries();
+        const auto third = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr3.wav"), formatManager);
+        REQUIRE( first.existsAsFile() );
+        cache.finishLoading();
+        REQUIRE( third.existsAsFile() );
+        REQUIRE( !first.existsAsFile() );
+        REQUIRE( !second.existsAsFile() );
+    }
+
+    SECTION("Recently used entries are not evicted")
+    {
+        SfzDecodedCache cache { cacheDirectory, 1 };
+        const auto first = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager);
+        cache.releaseEntries();
+        cache.getDecodedFile(samples.getChildFile("a0_vl4_rr2.wav"), formatManager);
+        cache.finishLoading();
+        REQUIRE( first.existsAsFile() );
+
+        first.setLastAccessTime(Time::getCurrentTime() - RelativeTime::hours(config::decodedCacheProtectionHours + 1));
+        cache.finishLoading();
+        REQUIRE( !first.existsAsFile() );
+    }
+
+    SECTION("The hashes are kept between sessions")
+    {
+        File entry;
+        {
+            SfzDecodedCache cache { cacheDirectory };
+            entry = cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager);
+            cache.finishLoading();
+        }
+        REQUIRE( cacheDirectory.getChildFile(config::decodedCacheIndexFile).existsAsFile() );
+
+        SfzDecodedCache cache { cacheDirectory };
+        REQUIRE( cache.getDecodedFile(samples.getChildFile("a0_vl4_rr1.wav"), formatManager) == entry );
+    }
+
+    cacheDirectory.deleteRecursively();
+}
@@ -189,6 +189,22 @@ TEST_CASE("Header hierarchy", "File tests")
         REQUIRE( synth.getNumRegions() == 8 );
     }
 
+    SECTION("Region opcodes override the inherited ones")
+    {
+        SfzSynth synth;
+        synth.loadSfzFile(std::filesystem::current_path() / "Tests/TestFiles/hierarchy_override.sfz");
+        REQUIRE( synth.getNumRegions() == 3 );
+        REQUIRE( synth.getRegionView(0)->keyRange == Range<uint8_t>(60, 60) );
+        REQUIRE( synth.getRegionView(0)->pitchKeycenter == 62 );
+        REQUIRE( synth.getRegionView(0)->volume == -6.0f );
+        REQUIRE( synth.getRegionView(1)->keyRange == Range<uint8_t>(64, 64) );
+        REQUIRE( synth.getRegionView(1)->pitchKeycenter == 64 );
+        REQUIRE( synth.getRegionView(1)->volume == -6.0f );
+        REQUIRE( synth.getRegionView(2)->keyRange == Range<uint8_t>(60, 60) );
+        REQUIRE( synth.getRegionView(2)->pitchKeycenter == 60 );
+        REQUIRE( synth.getRegionView(2)->volume == -3.0f );
+    }
+
     SECTION("Full hierarchy with antislashes")
     {
         {
@@ -293,4 +309,25 @@ TEST_CASE("Switches with files", "File tests")
         REQUIRE( !synth.getRegionView(2)->isSwitchedOn() );
         REQUIRE( synth.getRegionView(3)->isSwitchedOn() );
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Dispatch", "File tests")
+{
+    SECTION("CC conditions")
+    {
+        SfzSynth synth;
+        synth.loadSfzFile(std::filesystem::current_path() / "Tests/TestFiles/cc_conditions.sfz");
+        REQUIRE( synth.getNumRegions() == 2 );
+        REQUIRE( !synth.getRegionView(0)->isSwitchedOn() );
+        REQUIRE( synth.getRegionView(1)->isSwitchedOn() );
+        synth.registerCC(1, 64, 100, 0);
+        REQUIRE( synth.getRegionView(0)->isSwitchedOn() );
+        REQUIRE( synth.getRegionView(1)->isSwitchedOn() );
+        synth.registerCC(1, 64, 10, 0);
+        REQUIRE( !synth.getRegionView(0)->isSwitchedOn() );
+        REQUIRE( synth.getRegionView(1)->isSwitchedOn() );
+        synth.registerCC(1, 65, 10, 0);
+        REQUIRE( !synth.getRegionView(0)->isSwitchedOn() );
+        REQUIRE( synth.getRegionView(1)->isSwitchedOn() );
+    }
+}
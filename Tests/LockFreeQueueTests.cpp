@@ -0,0 +1,115 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzLockFreeQueue.h"
+#include "../Source/SfzGarbageCollector.h"
+#include <thread>
+#include <vector>
+#include <numeric>
+
+TEST_CASE("Lock-free queue", "Lock-free queue tests")
+{
+    SECTION("Capacity is rounded to a power of 2")
+    {
+        SfzLockFreeQueue<int> queue { 5 };
+        REQUIRE( queue.getCapacity() == 8 );
+    }
+
+    SECTION("Push and pop in order")
+    {
+        SfzLockFreeQueue<int> queue { 4 };
+        REQUIRE( queue.empty() );
+        REQUIRE( queue.push(1) );
+        REQUIRE( queue.push(2) );
+        REQUIRE( queue.push(3) );
+        REQUIRE( queue.getNumReady() == 3 );
+        int value { 0 };
+        REQUIRE( queue.pop(value) );
+        REQUIRE( value == 1 );
+        REQUIRE( queue.pop(value) );
+        REQUIRE( value == 2 );
+        REQUIRE( queue.pop(value) );
+        REQUIRE( value == 3 );
+        REQUIRE( !queue.pop(value) );
+    }
+
+    SECTION("Full queue")
+    {
+        SfzLockFreeQueue<int> queue { 2 };
+        REQUIRE( queue.push(1) );
+        REQUIRE( queue.push(2) );
+        REQUIRE( !queue.push(3) );
+        int value { 0 };
+        REQUIRE( queue.pop(value) );
+        REQUIRE( queue.push(3) );
+    }
+
+    SECTION("Failed pushes keep the value")
+    {
+        SfzLockFreeQueue<std::shared_ptr<int>> queue { 2 };
+        REQUIRE( queue.push(std::make_shared<int>(1)) );
+        REQUIRE( queue.push(std::make_shared<int>(2)) );
+        auto value = std::make_shared<int>(3);
+        REQUIRE( !queue.push(std::move(value)) );
+        REQUIRE( value != nullptr );
+        REQUIRE( *value == 3 );
+    }
+
+    SECTION("Multiple producers")
+    {
+        constexpr int numProducers { 4 };
+        constexpr int numValues { 1000 };
+        SfzLockFreeQueue<int> queue { numProducers * numValues };
+        std::vector<std::thread> producers;
+        for (int producerIdx = 0; producerIdx < numProducers; ++producerIdx)
+            producers.emplace_back([&queue]() {
+                for (int valueIdx = 1; valueIdx <= numValues; ++valueIdx)
+                    queue.push(valueIdx);
+            });
+        for (auto& producer: producers)
+            producer.join();
+
+        long sum { 0 };
+        int value { 0 };
+        while (queue.pop(value))
+            sum += value;
+        REQUIRE( sum == numProducers * numValues * (numValues + 1) / 2 );
+    }
+}
+
+TEST_CASE("Garbage collector", "Lock-free queue tests")
+{
+    SECTION("Replaced objects are dropped on collection")
+    {
+        SfzGarbageCollector<int> collector;
+        auto object = std::make_shared<int>(1);
+        std::weak_ptr<int> observer { object };
+        auto otherReference = std::make_shared<int>(2);
+        collector.retireWhenUnused(std::move(object));
+        collector.retireWhenUnused(otherReference);
+        collector.collect();
+        REQUIRE( observer.expired() );
+        REQUIRE( otherReference.use_count() == 1 );
+    }
+
+    SECTION("Replaced objects are kept while a hazard points to them")
+    {
+        SfzGarbageCollector<int> collector;
+        SfzGarbageCollector<int>::Hazard hazard { nullptr };
+        collector.addHazard(hazard);
+
+        auto object = std::make_shared<int>(1);
+        std::weak_ptr<int> observer { object };
+        std::atomic<int*> published { object.get() };
+        REQUIRE( SfzGarbageCollector<int>::acquire(published, hazard) == object.get() );
+
+        published = nullptr;
+        collector.retireWhenUnused(std::move(object));
+        collector.collect();
+        REQUIRE( !observer.expired() );
+
+        SfzGarbageCollector<int>::release(hazard);
+        collector.collect();
+        REQUIRE( observer.expired() );
+        collector.removeHazard(hazard);
+    }
+}
@@ -0,0 +1,46 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzLockedArena.h"
+
+TEST_CASE("Locked arena", "Locked arena tests")
+{
+    // Small enough to fit in the default locked memory limits
+    SfzLockedArena arena { 64 * 1024, false };
+    if (!arena.isValid())
+    {
+        WARN("Could not lock memory: " << arena.getStatus());
+        REQUIRE( arena.getStatus().isNotEmpty() );
+        return;
+    }
+
+    SECTION("Blocks are aligned and carved until the arena is full")
+    {
+        REQUIRE( arena.getSize() == 64 * 1024 );
+        auto* first = arena.allocate(100);
+        auto* second = arena.allocate(32 * 1024);
+        REQUIRE( first != nullptr );
+        REQUIRE( second != nullptr );
+        REQUIRE( reinterpret_cast<uintptr_t>(first) % config::lockedMemoryAlignment == 0 );
+        REQUIRE( reinterpret_cast<uintptr_t>(second) % config::lockedMemoryAlignment == 0 );
+        REQUIRE( arena.getUsedSize() == 128 + 32 * 1024 );
+        REQUIRE( arena.allocate(32 * 1024) == nullptr );
+
+        arena.release(first, 100);
+        arena.release(second, 32 * 1024);
+        REQUIRE( arena.getUsedSize() == 0 );
+    }
+
+    SECTION("Released blocks are merged back")
+    {
+        auto* first = arena.allocate(16 * 1024);
+        auto* second = arena.allocate(16 * 1024);
+        auto* third = arena.allocate(16 * 1024);
+        arena.release(first, 16 * 1024);
+        arena.release(third, 16 * 1024);
+        REQUIRE( arena.allocate(48 * 1024) == nullptr );
+        arena.release(second, 16 * 1024);
+        auto* whole = arena.allocate(64 * 1024);
+        REQUIRE( whole == first );
+        arena.release(whole, 64 * 1024);
+    }
+}
@@ -1,10 +1,12 @@
 #include "../JuceLibraryCode/JuceHeader.h"
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
 #include "catch2/catch.hpp"
+#include "../Source/SfzFilePool.h"
 
-
-// //==============================================================================
-// int main (int argc, char* argv[])
-// {
-//   return 0;
-// }
+int main (int argc, char* argv[])
+{
+    // The synths and file pools of the tests keep their sample metadata aside from the user's
+    TemporaryFile metadataCache;
+    SfzFilePool::setDefaultMetadataCacheFile(metadataCache.getFile());
+    return Catch::Session().run(argc, argv);
+}
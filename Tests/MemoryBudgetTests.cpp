@@ -0,0 +1,109 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzMemoryBudget.h"
+#include "../Source/SfzFilePool.h"
+#include <filesystem>
+
+namespace
+{
+    // Holds a few blocks of memory, each with its priority
+    class FakeClient: public SfzMemoryBudget::Client
+    {
+    public:
+        FakeClient(SfzMemoryBudget& budget, std::vector<float> priorities, int64 blockSize)
+        : budget(budget), priorities(priorities), blockSize(blockSize), evicted(priorities.size(), false)
+        {
+            budget.allocate(SfzMemoryCategory::preload, blockSize * static_cast<int64>(priorities.size()));
+            budget.addClient(this);
+        }
+
+        ~FakeClient()
+        {
+            budget.removeClient(this);
+        }
+
+        void addEvictionCandidates(std::vector<SfzMemoryBudget::EvictionCandidate>& candidates) override
+        {
+            for (int blockIdx = 0; blockIdx < static_cast<int>(priorities.size()); ++blockIdx)
+                if (!evicted[blockIdx])
+                    candidates.push_back({ this, blockIdx, priorities[blockIdx], blockSize });
+        }
+
+        int64 evict(int blockIdx) override
+        {
+            evicted[blockIdx] = true;
+            budget.release(SfzMemoryCategory::preload, blockSize);
+            return blockSize;
+        }
+
+        SfzMemoryBudget& budget;
+        std::vector<float> priorities;
+        int64 blockSize;
+        std::vector<bool> evicted;
+    };
+}
+
+TEST_CASE("Memory budget", "Memory budget tests")
+{
+    SECTION("Usage and headroom")
+    {
+        SfzMemoryBudget budget;
+        REQUIRE( budget.getHeadroom() == -1 );
+        budget.allocate(SfzMemoryCategory::preload, 1000);
+        budget.allocate(SfzMemoryCategory::streaming, 500);
+        REQUIRE( budget.getUsage() == 1500 );
+        REQUIRE( budget.getUsage(SfzMemoryCategory::streaming) == 500 );
+        REQUIRE( !budget.isOverLimit() );
+
+        budget.setLimit(2000);
+        REQUIRE( budget.getHeadroom() == 500 );
+        budget.setLimit(1000);
+        REQUIRE( budget.getHeadroom() == 0 );
+        REQUIRE( budget.isOverLimit() );
+        budget.release(SfzMemoryCategory::preload, 1000);
+        budget.release(SfzMemoryCategory::streaming, 500);
+        REQUIRE( budget.getUsage() == 0 );
+    }
+
+    SECTION("Lowest priorities are evicted first, across clients")
+    {
+        SfzMemoryBudget budget;
+        FakeClient first { budget, { 3.0f, 0.5f, 10.0f }, 100 };
+        FakeClient second { budget, { 0.1f, 2.0f }, 100 };
+        REQUIRE( budget.enforce() );
+        REQUIRE( budget.getUsage() == 500 );
+
+        budget.setLimit(250);
+        REQUIRE( budget.enforce() );
+        // Down to 90% of the limit
+        REQUIRE( budget.getUsage() == 200 );
+        REQUIRE( second.evicted[0] );
+        REQUIRE( first.evicted[1] );
+        REQUIRE( second.evicted[1] );
+        REQUIRE( !first.evicted[0] );
+        REQUIRE( !first.evicted[2] );
+    }
+
+    SECTION("File pools shrink their preloads")
+    {
+        SfzMemoryBudget budget;
+        SfzFilePool filePool { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/SpecificBugs/MeatBassPizz/Samples/pizz", budget };
+        filePool.setMetadataCacheFile({});
+        const auto played = filePool.preload("a0_vl4_rr1.wav", 0, 0);
+        const auto notPlayed = filePool.preload("a0_vl4_rr2.wav", 0, 0);
+        REQUIRE( played != invalidSampleId );
+        REQUIRE( notPlayed != invalidSampleId );
+        REQUIRE( budget.getUsage() == filePool.getPreloadedBytes() );
+        filePool.getStatistics(played)->plays++;
+
+        const auto fullSize = filePool.getPreloadedData(played)->getNumSamples();
+        budget.setLimit(budget.getUsage() - 1);
+        REQUIRE( budget.enforce() );
+        REQUIRE( filePool.getPreloadedData(notPlayed)->getNumSamples() == config::minimumPreloadSize );
+        REQUIRE( filePool.getPreloadedData(played)->getNumSamples() == fullSize );
+        REQUIRE( budget.getUsage() == filePool.getPreloadedBytes() );
+
+        filePool.clear();
+        REQUIRE( budget.getUsage() == 0 );
+    }
+}
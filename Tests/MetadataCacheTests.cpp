@@ -0,0 +1,85 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzMetadataCache.h"
+#include <filesystem>
+
+TEST_CASE("Sample metadata cache", "Metadata cache tests")
+{
+    const File samples { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/SpecificBugs/MeatBassPizz/Samples/pizz" };
+    const auto cacheFile = File::getSpecialLocation(File::tempDirectory).getChildFile("SfzMetadataCacheTests/metadata.cache");
+    cacheFile.getParentDirectory().deleteRecursively();
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    const auto sampleFile = samples.getChildFile("a0_vl4_rr1.wav");
+    std::unique_ptr<AudioFormatReader> reader { formatManager.createReaderFor(sampleFile) };
+    REQUIRE( reader != nullptr );
+    auto sampleInfo = SfzSampleInfo::fromReader(*reader);
+    sampleInfo.loopRange = Range<uint32_t>(100, 2000);
+
+    SECTION("Entries are kept between sessions")
+    {
+        {
+            SfzMetadataCache cache { cacheFile };
+            REQUIRE( !cache.find(sampleFile) );
+            cache.store(sampleFile, sampleInfo);
+            REQUIRE( cache.find(sampleFile) );
+            REQUIRE( cache.save() );
+        }
+        REQUIRE( cacheFile.existsAsFile() );
+
+        SfzMetadataCache cache { cacheFile };
+        REQUIRE( cache.getNumEntries() == 1 );
+        const auto cached = cache.find(sampleFile);
+        REQUIRE( cached );
+        REQUIRE( cached->sampleRate == reader->sampleRate );
+        REQUIRE( cached->numChannels == static_cast<int>(reader->numChannels) );
+        REQUIRE( cached->lengthInSamples == reader->lengthInSamples );
+        REQUIRE( cached->loopRange );
+        REQUIRE( *cached->loopRange == Range<uint32_t>(100, 2000) );
+        REQUIRE( !cache.find(samples.getChildFile("a0_vl4_rr2.wav")) );
+    }
+
+    SECTION("Modified samples are probed again")
+    {
+        const auto copiedSample = cacheFile.getSiblingFile("copied.wav");
+        cacheFile.getParentDirectory().createDirectory();
+        REQUIRE( sampleFile.copyFileTo(copiedSample) );
+
+        SfzMetadataCache cache { cacheFile };
+        cache.store(copiedSample, sampleInfo);
+        REQUIRE( cache.find(copiedSample) );
+        copiedSample.setLastModificationTime(copiedSample.getLastModificationTime() + RelativeTime::seconds(10));
+        REQUIRE( !cache.find(copiedSample) );
+    }
+
+    SECTION("Invalid cache files are ignored")
+    {
+        cacheFile.getParentDirectory().createDirectory();
+        cacheFile.replaceWithText("not a cache");
+        SfzMetadataCache cache { cacheFile };
+        REQUIRE( cache.getNumEntries() == 0 );
+        cache.store(sampleFile, sampleInfo);
+        REQUIRE( cache.save() );
+        REQUIRE( SfzMetadataCache(cacheFile).getNumEntries() == 1 );
+    }
+
+    SECTION("Truncated entries are ignored")
+    {
+        {
+            SfzMetadataCache cache { cacheFile };
+            cache.store(sampleFile, sampleInfo);
+            REQUIRE( cache.save() );
+        }
+
+        MemoryBlock table;
+        REQUIRE( cacheFile.loadFileAsData(table) );
+        table.setSize(table.getSize() - 4);
+        REQUIRE( cacheFile.replaceWithData(table.getData(), table.getSize()) );
+        SfzMetadataCache cache { cacheFile };
+        REQUIRE( cache.getNumEntries() == 0 );
+        REQUIRE( !cache.find(sampleFile) );
+    }
+
+    cacheFile.getParentDirectory().deleteRecursively();
+}
@@ -39,6 +39,22 @@ TEST_CASE("Opcode Construction", "Opcode class tests")
         REQUIRE( *opcode.parameter == 123 );
     }
 
+    SECTION("Parameters above 255")
+    {
+        SfzOpcode opcode { "hicc300", "64" };
+        REQUIRE( opcode.opcode == "hicc" );
+        REQUIRE( opcode.parameter );
+        REQUIRE( *opcode.parameter == 300 );
+        REQUIRE( opcode.opcodeHash == hash("hicc") );
+    }
+
+    SECTION("Parameters that do not fit")
+    {
+        SfzOpcode opcode { "hicc123456", "64" };
+        REQUIRE( opcode.opcode == "hicc123456" );
+        REQUIRE( !opcode.parameter );
+    }
+
     // TODO: I would say these are out of spec
     // SECTION("Badly parameterized opcode")
     // {
@@ -80,4 +96,20 @@ TEST_CASE("Opcodes helpers", "Opcode tests")
         REQUIRE( noteValue );
         REQUIRE( *noteValue == 61);
     }
+
+    SECTION("Numeric values")
+    {
+        REQUIRE( *readOpcode<int>("42", { 0, 100 }) == 42 );
+        REQUIRE( *readOpcode<int>("+42", { 0, 100 }) == 42 );
+        REQUIRE( *readOpcode<int>("142", { 0, 100 }) == 100 );
+        REQUIRE( *readOpcode<uint8_t>("-12", { 0, 127 }) == 0 );
+        REQUIRE( *readOpcode<uint8_t>("4000", { 0, 127 }) == 127 );
+        REQUIRE( !readOpcode<int>("c4", { 0, 127 }) );
+        REQUIRE( !readOpcode<int>("", { 0, 127 }) );
+        REQUIRE( *readOpcode<float>("0.5", { 0.0f, 1.0f }) == 0.5_a );
+        REQUIRE( *readOpcode<float>("-6.5", { -144.0f, 6.0f }) == -6.5_a );
+        REQUIRE( *readOpcode<float>("12", { -144.0f, 6.0f }) == 6.0_a );
+        REQUIRE( !readOpcode<float>("abc", { 0.0f, 1.0f }) );
+        REQUIRE( !readOpcode<float>("", { 0.0f, 1.0f }) );
+    }
 }
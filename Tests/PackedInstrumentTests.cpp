@@ -0,0 +1,74 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzPackedInstrument.h"
+#include "../Source/SfzSynth.h"
+#include <filesystem>
+
+TEST_CASE("Packed instruments", "Packed instrument tests")
+{
+    const File regions { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/Regions" };
+    const auto packFile = File::getSpecialLocation(File::tempDirectory).getChildFile("SfzPackedInstrumentTests.sfzpack");
+    packFile.deleteFile();
+
+    SfzSynth looseSynth;
+    REQUIRE( looseSynth.loadSfzFile(std::filesystem::current_path() / "Tests/TestFiles/Regions/regions_many.sfz") );
+    REQUIRE( looseSynth.exportPackedInstrument(packFile) );
+
+    SECTION("The index matches the loose samples")
+    {
+        SfzPackedInstrument pack { packFile };
+        REQUIRE( pack.isValid() );
+        REQUIRE( pack.getNumSamples() == 3 );
+        REQUIRE( pack.getEntry("missing.wav") == nullptr );
+
+        AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        for (auto sampleName: { "dummy.wav", "dummy.1.wav", "dummy.2.wav" })
+        {
+            const auto* entry = pack.getEntry(sampleName);
+            REQUIRE( entry != nullptr );
+            REQUIRE( entry->offset % config::packAlignment == 0 );
+
+            std::unique_ptr<AudioFormatReader> loose { formatManager.createReaderFor(regions.getChildFile(sampleName)) };
+            auto packed = pack.createReaderFor(sampleName);
+            REQUIRE( packed != nullptr );
+            REQUIRE( entry->info.lengthInSamples == loose->lengthInSamples );
+            REQUIRE( packed->lengthInSamples == loose->lengthInSamples );
+            REQUIRE( packed->numChannels == loose->numChannels );
+
+            const auto numFrames = static_cast<int>(loose->lengthInSamples);
+            AudioBuffer<float> expected { 2, numFrames };
+            AudioBuffer<float> actual { 2, numFrames };
+            loose->read(&expected, 0, numFrames, 0, true, true);
+            packed->read(&actual, 0, numFrames, 0, true, true);
+            for (int channelIdx = 0; channelIdx < 2; ++channelIdx)
+                for (int frameIdx = 0; frameIdx < numFrames; ++frameIdx)
+                    REQUIRE( actual.getSample(channelIdx, frameIdx) == expected.getSample(channelIdx, frameIdx) );
+        }
+    }
+
+    SECTION("Loading a pack gives the same regions")
+    {
+        SfzSynth packedSynth;
+        REQUIRE( packedSynth.loadSfzFile(packFile.getFullPathName().toStdString()) );
+        REQUIRE( packedSynth.getNumRegions() == looseSynth.getNumRegions() );
+        for (int regionIdx = 0; regionIdx < looseSynth.getNumRegions(); ++regionIdx)
+        {
+            REQUIRE( packedSynth.getRegionView(regionIdx)->sample == looseSynth.getRegionView(regionIdx)->sample );
+            REQUIRE( packedSynth.getRegionView(regionIdx)->sampleEnd == looseSynth.getRegionView(regionIdx)->sampleEnd );
+            REQUIRE( packedSynth.getRegionView(regionIdx)->numChannels == looseSynth.getRegionView(regionIdx)->numChannels );
+        }
+    }
+
+    SECTION("Invalid packs are rejected")
+    {
+        const auto notAPack = File::getSpecialLocation(File::tempDirectory).getChildFile("SfzPackedInstrumentTests-invalid.sfzpack");
+        notAPack.replaceWithText("<region> sample=dummy.wav");
+        REQUIRE( !SfzPackedInstrument(notAPack).isValid() );
+        SfzSynth synth;
+        REQUIRE( !synth.loadSfzFile(notAPack.getFullPathName().toStdString()) );
+        notAPack.deleteFile();
+    }
+
+    packFile.deleteFile();
+}
@@ -0,0 +1,45 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzPreprocessor.h"
+#include <filesystem>
+
+TEST_CASE("Preprocessor", "Preprocessor tests")
+{
+    const auto includes = std::filesystem::current_path() / "Tests/TestFiles/Includes";
+
+    SECTION("Includes are expanded in order")
+    {
+        SfzPreprocessor preprocessor { includes };
+        REQUIRE( preprocessor.process(includes / "multiple_includes_with_comments.sfz") == "<region> sample=dummy.wav <region> sample=dummy2.wav " );
+        REQUIRE( preprocessor.getIncludedFiles().size() == 2 );
+        REQUIRE( preprocessor.getIncludedFiles()[0] == includes / "included.sfz" );
+        REQUIRE( preprocessor.getIncludedFiles()[1] == includes / "included_2.sfz" );
+    }
+
+    SECTION("Include loops are read once")
+    {
+        SfzPreprocessor preprocessor { includes };
+        REQUIRE( preprocessor.process(includes / "root_loop.sfz") == "<region> sample=dummy_loop2.wav <region> sample=dummy_loop1.wav " );
+    }
+
+    SECTION("Defines apply to the lines that follow them, included files too")
+    {
+        SfzPreprocessor preprocessor { includes };
+        const auto output = preprocessor.process(includes / "root_defines.sfz");
+        REQUIRE( output == "<region> sample=$LATE.wav "
+                           "<region> key=36 sample=kick.wav "
+                           "<region> key=36 sample=snare.wav "
+                           "<region> key=24 sample=snaresuffix.wav " );
+        const auto defines = preprocessor.getDefines();
+        REQUIRE( defines.size() == 4 );
+        REQUIRE( defines.at("$KEYSWITCH") == "24" );
+        REQUIRE( defines.at("$LATE") == "late" );
+    }
+
+    SECTION("Missing files")
+    {
+        SfzPreprocessor preprocessor { includes };
+        REQUIRE( preprocessor.process(includes / "missing.sfz").empty() );
+        REQUIRE( preprocessor.getIncludedFiles().empty() );
+    }
+}
@@ -0,0 +1,66 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzRandom.h"
+#include <vector>
+
+TEST_CASE("Random", "Random tests")
+{
+    SECTION("The same seed gives the same sequence")
+    {
+        SfzRandom first { 42 };
+        SfzRandom second { 42 };
+        std::vector<uint32_t> sequence;
+        for (int i = 0; i < 100; ++i)
+        {
+            sequence.push_back(first.next());
+            REQUIRE( sequence.back() == second.next() );
+        }
+
+        first.setSeed(42);
+        for (auto value: sequence)
+            REQUIRE( first.next() == value );
+    }
+
+    SECTION("Different seeds give different sequences")
+    {
+        SfzRandom first { 1 };
+        SfzRandom second { 2 };
+        int numEqual { 0 };
+        for (int i = 0; i < 100; ++i)
+            if (first.next() == second.next())
+                numEqual++;
+        REQUIRE( numEqual < 2 );
+    }
+
+    SECTION("Ranges")
+    {
+        SfzRandom random { 0 };
+        float minFloat { 1.0f };
+        float maxFloat { 0.0f };
+        for (int i = 0; i < 10000; ++i)
+        {
+            const auto value = random.nextFloat();
+            REQUIRE( value >= 0.0f );
+            REQUIRE( value < 1.0f );
+            minFloat = jmin(minFloat, value);
+            maxFloat = jmax(maxFloat, value);
+        }
+        REQUIRE( minFloat < 0.01f );
+        REQUIRE( maxFloat > 0.99f );
+
+        std::vector<int> counts(10, 0);
+        for (int i = 0; i < 10000; ++i)
+        {
+            const auto value = random.nextInt(10);
+            REQUIRE( value >= 0 );
+            REQUIRE( value < 10 );
+            counts[value]++;
+        }
+        for (auto count: counts)
+            REQUIRE( count > 800 );
+
+        REQUIRE( random.nextInt(0) == 0 );
+        REQUIRE( random.nextInt(-5) == 0 );
+        REQUIRE( random.nextInt(1) == 0 );
+    }
+}
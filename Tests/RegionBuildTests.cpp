@@ -258,6 +258,9 @@ TEST_CASE("Parsing opcodes", "Region tests")
         REQUIRE( region.ccConditions[65] == Range<uint8_t>(0, 39) );
         region.parseOpcode({ "hicc127", "135" });
         REQUIRE( region.ccConditions[127] == Range<uint8_t>(0, 127) );
+        region.parseOpcode({ "locc300", "10" });
+        REQUIRE( !region.ccConditions.contains(44) );
+        REQUIRE( !region.ccConditions.contains(300) );
     }
 
     SECTION("sw_lokey, sw_hikey")
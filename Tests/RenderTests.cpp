@@ -0,0 +1,111 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzSynth.h"
+#include <filesystem>
+
+namespace
+{
+constexpr int renderLength { 1024 };
+
+// Render the events in blocks of hostBlockSize frames, as a host would
+AudioBuffer<float> render(const MidiBuffer& midiMessages, int hostBlockSize, int minimumSliceSize = config::minimumRenderSlice, int preparedBlockSize = renderLength)
+{
+    SfzSynth synth;
+    synth.setRandomSeed(1);
+    synth.setMinimumSliceSize(minimumSliceSize);
+    synth.loadSfzFile(std::filesystem::current_path() / "Tests/TestFiles/render.sfz");
+    synth.prepareToPlay(config::defaultSampleRate, preparedBlockSize);
+
+    AudioBuffer<float> output { config::numChannels, renderLength };
+    output.clear();
+    for (int startSample = 0; startSample < renderLength; startSample += hostBlockSize)
+        synth.renderNextBlock(output, midiMessages, startSample, jmin(hostBlockSize, renderLength - startSample));
+    return output;
+}
+
+float maxDifference(const AudioBuffer<float>& lhs, const AudioBuffer<float>& rhs)
+{
+    float difference { 0.0f };
+    for (int channelIdx = 0; channelIdx < config::numChannels; ++channelIdx)
+        for (int sampleIdx = 0; sampleIdx < renderLength; ++sampleIdx)
+            difference = jmax(difference, std::abs(lhs.getSample(channelIdx, sampleIdx) - rhs.getSample(channelIdx, sampleIdx)));
+    return difference;
+}
+}
+
+TEST_CASE("Event scheduling", "Render tests")
+{
+    constexpr int noteOnFrame { 300 };
+
+    SECTION("Generators start on the frame of the note-on")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 60, static_cast<uint8>(100)), noteOnFrame);
+        const auto reference = render(midiMessages, renderLength, 1);
+        REQUIRE( reference.getMagnitude(0, noteOnFrame) == 0.0f );
+        REQUIRE( reference.getMagnitude(noteOnFrame, renderLength - noteOnFrame) > 0.0f );
+
+        REQUIRE( maxDifference(reference, render(midiMessages, renderLength)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 256)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 100)) < 1e-6f );
+    }
+
+    SECTION("Samples start on the frame of the note-on")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 62, static_cast<uint8>(100)), noteOnFrame);
+        const auto reference = render(midiMessages, renderLength, 1);
+        REQUIRE( reference.getMagnitude(0, noteOnFrame) == 0.0f );
+        REQUIRE( reference.getMagnitude(noteOnFrame, renderLength - noteOnFrame) > 0.0f );
+
+        REQUIRE( maxDifference(reference, render(midiMessages, renderLength)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 256)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 100)) < 1e-6f );
+    }
+
+    SECTION("Note-offs release on their frame")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 60, static_cast<uint8>(100)), 0);
+        midiMessages.addEvent(MidiMessage::noteOff(1, 60), noteOnFrame);
+        const auto reference = render(midiMessages, renderLength, 1);
+        REQUIRE( maxDifference(reference, render(midiMessages, 256)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 100)) < 1e-6f );
+    }
+}
+
+TEST_CASE("Render quantum", "Render tests")
+{
+    SECTION("Blocks larger than announced render the same")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 60, static_cast<uint8>(100)), 10);
+        midiMessages.addEvent(MidiMessage::noteOn(1, 62, static_cast<uint8>(100)), 20);
+        const auto reference = render(midiMessages, renderLength);
+        REQUIRE( reference.getMagnitude(0, renderLength) > 0.0f );
+        REQUIRE( maxDifference(reference, render(midiMessages, renderLength, config::minimumRenderSlice, 64)) < 1e-6f );
+        REQUIRE( maxDifference(reference, render(midiMessages, config::renderQuantum + 1, config::minimumRenderSlice, 64)) < 1e-6f );
+    }
+}
+
+TEST_CASE("Render paths", "Render tests")
+{
+    SECTION("Mono samples play on all the outputs")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 62, static_cast<uint8>(100)), 0);
+        const auto output = render(midiMessages, renderLength);
+        REQUIRE( output.getMagnitude(0, 0, renderLength) > 0.0f );
+        for (int sampleIdx = 0; sampleIdx < renderLength; ++sampleIdx)
+            REQUIRE( output.getSample(0, sampleIdx) == output.getSample(1, sampleIdx) );
+    }
+
+    SECTION("Short loops")
+    {
+        MidiBuffer midiMessages;
+        midiMessages.addEvent(MidiMessage::noteOn(1, 64, static_cast<uint8>(100)), 0);
+        const auto reference = render(midiMessages, renderLength);
+        REQUIRE( reference.getMagnitude(renderLength - 100, 100) > 0.0f );
+        REQUIRE( maxDifference(reference, render(midiMessages, 100)) < 1e-6f );
+    }
+}
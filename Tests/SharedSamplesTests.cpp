@@ -0,0 +1,71 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzSharedSamples.h"
+#include "../Source/SfzFilePool.h"
+#include <filesystem>
+
+TEST_CASE("Shared samples", "Shared samples tests")
+{
+    const File samples { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/SpecificBugs/MeatBassPizz/Samples/pizz" };
+    SfzMemoryBudget budget;
+    SfzSharedSamples sharedSamples;
+
+    SECTION("Entries live as long as they are used")
+    {
+        auto data = std::make_shared<AudioBuffer<float>>(2, 100);
+        sharedSamples.publish("sample", data);
+        REQUIRE( sharedSamples.find("sample", 100) == data );
+        REQUIRE( sharedSamples.find("sample", 101) == nullptr );
+        REQUIRE( sharedSamples.getNumSamplesInUse() == 1 );
+
+        auto shorter = std::make_shared<AudioBuffer<float>>(2, 50);
+        sharedSamples.publish("sample", shorter);
+        REQUIRE( sharedSamples.find("sample", 10) == data );
+
+        data.reset();
+        REQUIRE( sharedSamples.find("sample", 10) == nullptr );
+        REQUIRE( sharedSamples.getNumSamplesInUse() == 0 );
+    }
+
+    SECTION("File pools share their preloads")
+    {
+        SfzFilePool first { samples, budget, sharedSamples };
+        SfzFilePool second { samples, budget, sharedSamples };
+        first.setMetadataCacheFile({});
+        second.setMetadataCacheFile({});
+
+        const auto firstId = first.preload("a0_vl4_rr1.wav");
+        const auto secondId = second.preload("a0_vl4_rr1.wav");
+        REQUIRE( second.getNumSharedPreloads() == 1 );
+        REQUIRE( first.getPreloadedData(firstId) == second.getPreloadedData(secondId) );
+        REQUIRE( budget.getUsage() == first.getPreloadedBytes() );
+
+        // A longer preload is read again and offered to the others
+        const auto wholeId = second.preload("a0_vl4_rr1.wav", 0, 0);
+        REQUIRE( wholeId == secondId );
+        REQUIRE( second.getPreloadedData(secondId)->getNumSamples() > first.getPreloadedData(firstId)->getNumSamples() );
+        REQUIRE( sharedSamples.find(second.getSampleKey("a0_vl4_rr1.wav"), 1) == second.getPreloadedData(secondId) );
+
+        first.clear();
+        REQUIRE( budget.getUsage() == second.getPreloadedBytes() );
+        second.clear();
+        REQUIRE( budget.getUsage() == 0 );
+    }
+
+    SECTION("Shared preloads are not shrunk")
+    {
+        SfzFilePool first { samples, budget, sharedSamples };
+        SfzFilePool second { samples, budget, sharedSamples };
+        first.setMetadataCacheFile({});
+        second.setMetadataCacheFile({});
+
+        const auto firstId = first.preload("a0_vl4_rr1.wav", 0, 0);
+        const auto secondId = second.preload("a0_vl4_rr1.wav", 0, 0);
+        const auto usage = budget.getUsage();
+        budget.setLimit(usage - 1);
+        REQUIRE( !budget.enforce() );
+        REQUIRE( budget.getUsage() == usage );
+        REQUIRE( first.getPreloadedData(firstId) == second.getPreloadedData(secondId) );
+        budget.setLimit(0);
+    }
+}
@@ -0,0 +1,47 @@
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "catch2/catch.hpp"
+#include "../Source/SfzFilePool.h"
+#include <filesystem>
+
+TEST_CASE("Stream readers", "Stream reader tests")
+{
+    const File directory { String(std::filesystem::current_path().string()) + "/Tests/TestFiles/SpecificBugs/MeatBassPizz/Samples/pizz" };
+    SfzFilePool filePool { directory };
+    const String sample { "a0_vl4_rr1.wav" };
+
+    SECTION("The stream reader reads the same as JUCE")
+    {
+        auto formatReader = filePool.createReaderFor(sample);
+        auto streamReader = filePool.createStreamReader(sample);
+        REQUIRE( formatReader != nullptr );
+        REQUIRE( streamReader != nullptr );
+        REQUIRE( streamReader->getLengthInSamples() == formatReader->lengthInSamples );
+
+        const int numFrames { 4096 };
+        AudioBuffer<float> expected { config::numChannels, numFrames };
+        AudioBuffer<float> actual { config::numChannels, numFrames };
+        formatReader->read(&expected, 0, numFrames, 1000, true, true);
+        // Read in two segments to go through the batching
+        const SfzStreamReader::Segment segments[] {
+            { &actual, 0, 1000, numFrames / 2 },
+            { &actual, numFrames / 2, 1000 + numFrames / 2, numFrames / 2 }
+        };
+        REQUIRE( streamReader->read(segments, 2) );
+
+        for (int chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+            for (int frameIdx = 0; frameIdx < numFrames; ++frameIdx)
+                REQUIRE( actual.getSample(chanIdx, frameIdx) == Approx(expected.getSample(chanIdx, frameIdx)).margin(1e-6) );
+    }
+
+    SECTION("Frames past the end are cleared")
+    {
+        auto streamReader = filePool.createStreamReader(sample);
+        REQUIRE( streamReader != nullptr );
+        AudioBuffer<float> buffer { config::numChannels, 16 };
+        const SfzStreamReader::Segment segment { &buffer, 0, streamReader->getLengthInSamples() - 8, 16 };
+        streamReader->read(&segment, 1);
+        for (int chanIdx = 0; chanIdx < config::numChannels; ++chanIdx)
+            for (int frameIdx = 8; frameIdx < 16; ++frameIdx)
+                REQUIRE( buffer.getSample(chanIdx, frameIdx) == 0.0f );
+    }
+}
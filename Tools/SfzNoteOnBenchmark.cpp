@@ -0,0 +1,101 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../Source/SfzSynth.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Measures the time spent in SfzSynth::registerNoteOn() for chords:
+//   sfizz_bench_noteon [instrument.sfz] [chord size] [iterations]
+// Without an instrument, a generated one is used: 88 keys with 8 crossfaded
+// velocity layers of generated sines, with key and velocity tracking.
+namespace
+{
+    std::filesystem::path writeGeneratedInstrument()
+    {
+        const auto path = std::filesystem::temp_directory_path() / "sfizz_bench_noteon.sfz";
+        std::ofstream sfz { path };
+        sfz << "<global> amp_veltrack=100 pitch_keytrack=100 pitch_veltrack=50 xf_velcurve=power\n";
+        constexpr int numLayers { 8 };
+        constexpr int layerSize { 128 / numLayers };
+        for (int layer = 0; layer < numLayers; ++layer)
+        {
+            const auto low = std::max(1, layer * layerSize - 4);
+            const auto high = std::min(127, (layer + 1) * layerSize + 3);
+            sfz << "<group> lovel=" << low << " hivel=" << high
+                << " xfin_lovel=" << low << " xfin_hivel=" << std::min(high, low + 8)
+                << " xfout_lovel=" << std::max(low, high - 8) << " xfout_hivel=" << high
+                << " amp_velcurve_" << low << "=0.2 amp_velcurve_" << high << "=0.9\n";
+            for (int key = 21; key <= 108; ++key)
+                sfz << "<region> key=" << key << " sample=*sine\n";
+        }
+        return path;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const auto instrument = argc > 1 ? std::filesystem::absolute(argv[1]) : writeGeneratedInstrument();
+    const int chordSize = argc > 2 ? std::max(1, std::atoi(argv[2])) : 16;
+    const int iterations = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1000;
+    constexpr int numVoices { 256 };
+
+    SfzSynth synth;
+    if (!synth.loadSfzFile(instrument))
+    {
+        std::cerr << "Could not load " << instrument.string() << '\n';
+        return 1;
+    }
+    synth.prepareToPlay(config::defaultSampleRate, config::defaultSamplesPerBlock);
+
+    Random random { 1 };
+    std::vector<double> durations;
+    durations.reserve(iterations);
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        synth.initalizeVoices(numVoices);
+        const auto lowestNote = 21 + random.nextInt(88 - chordSize);
+        const auto velocity = static_cast<uint8_t>(1 + random.nextInt(127));
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int note = 0; note < chordSize; ++note)
+            synth.registerNoteOn(1, lowestNote + note, velocity, 0);
+        const auto end = std::chrono::steady_clock::now();
+        durations.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+
+    std::sort(durations.begin(), durations.end());
+    double total { 0.0 };
+    for (auto duration: durations)
+        total += duration;
+
+    std::cout << synth.getNumRegions() << " regions, chords of " << chordSize << " notes, " << iterations << " iterations\n"
+              << "Note-on per chord (us): mean " << total / iterations
+              << ", median " << durations[iterations / 2]
+              << ", 99th percentile " << durations[iterations * 99 / 100]
+              << ", max " << durations.back() << '\n';
+    return 0;
+}
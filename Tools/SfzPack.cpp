@@ -0,0 +1,55 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../Source/SfzSynth.h"
+#include <iostream>
+
+// Packs an sfz instrument and its samples in a single file that sfizz can load directly:
+//   sfizz_pack instrument.sfz [output.sfzpack]
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " instrument.sfz [output." << config::packedInstrumentExtension << "]\n";
+        return 1;
+    }
+
+    const File sfzFile { File::getCurrentWorkingDirectory().getChildFile(argv[1]) };
+    const File outputFile = argc > 2 ? File::getCurrentWorkingDirectory().getChildFile(argv[2])
+                                     : sfzFile.withFileExtension(config::packedInstrumentExtension);
+
+    SfzSynth synth;
+    if (!synth.loadSfzFile(sfzFile.getFullPathName().toStdString()))
+    {
+        std::cerr << "Could not load " << sfzFile.getFullPathName() << '\n';
+        return 1;
+    }
+
+    if (!synth.exportPackedInstrument(outputFile))
+    {
+        std::cerr << "Could not write " << outputFile.getFullPathName() << '\n';
+        return 1;
+    }
+
+    std::cout << "Packed " << synth.getNumRegions() << " regions in " << outputFile.getFullPathName() << '\n';
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+    ==============================================================================
+
+    Copyright 2019 - Paul Ferrand (paulfd@outlook.fr)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ==============================================================================
+*/
+
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../Source/SfzSynth.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Measures the rendering time of the voices for each of their render paths:
+//   sfizz_bench_render [chord size] [blocks] [block size]
+// Generated instruments cover the combinations of source (sine, mono or
+// stereo sample), loop and preloaded or streamed data; the time is given
+// per voice and per output frame.
+namespace
+{
+    constexpr int shortSampleLength { config::preloadSize };
+    constexpr int longSampleLength { 16 * config::preloadSize };
+
+    File writeSample(const File& directory, int numChannels, int length)
+    {
+        const auto file = directory.getChildFile("sample_" + String(numChannels) + "ch_" + String(length) + ".wav");
+        if (file.existsAsFile())
+            return file;
+
+        AudioBuffer<float> data { numChannels, length };
+        for (int channelIdx = 0; channelIdx < numChannels; ++channelIdx)
+            for (int sampleIdx = 0; sampleIdx < length; ++sampleIdx)
+                data.setSample(channelIdx, sampleIdx, 0.5f * std::sin(MathConstants<float>::twoPi * 220.0f * sampleIdx / 48000.0f + channelIdx));
+
+        WavAudioFormat format;
+        std::unique_ptr<AudioFormatWriter> writer { format.createWriterFor(new FileOutputStream(file), 48000.0, static_cast<unsigned int>(numChannels), 16, {}, 0) };
+        if (writer == nullptr || !writer->writeFromAudioSampleBuffer(data, 0, length))
+            std::cerr << "Could not write " << file.getFullPathName() << '\n';
+        return file;
+    }
+
+    struct Case
+    {
+        std::string name;
+        std::string region;
+    };
+
+    std::vector<Case> generateCases(const File& directory)
+    {
+        std::vector<Case> cases;
+        cases.push_back({ "sine", "sample=*sine" });
+        for (int numChannels: { 1, 2 })
+        {
+            const auto channels = numChannels == 1 ? std::string("mono") : std::string("stereo");
+            const auto shortSample = writeSample(directory, numChannels, shortSampleLength).getFileName().toStdString();
+            const auto longSample = writeSample(directory, numChannels, longSampleLength).getFileName().toStdString();
+            cases.push_back({ channels + ", loop, preloaded", "sample=" + shortSample + " loop_mode=loop_continuous loop_start=0 loop_end=" + std::to_string(shortSampleLength - 1) });
+            cases.push_back({ channels + ", loop, streamed", "sample=" + longSample + " loop_mode=loop_continuous loop_start=" + std::to_string(longSampleLength / 2) + " loop_end=" + std::to_string(longSampleLength - 1) });
+            cases.push_back({ channels + ", no loop, streamed", "sample=" + longSample + " loop_mode=no_loop" });
+        }
+        return cases;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int chordSize = argc > 1 ? std::max(1, std::atoi(argv[1])) : 16;
+    const int numBlocks = argc > 2 ? std::max(1, std::atoi(argv[2])) : 200;
+    const int blockSize = argc > 3 ? std::max(1, std::atoi(argv[3])) : 512;
+
+    const auto directory = File::getSpecialLocation(File::tempDirectory).getChildFile("sfizz_bench_render");
+    directory.createDirectory();
+
+    AudioBuffer<float> output { config::numChannels, blockSize };
+    std::cout << "Chords of " << chordSize << " notes, " << numBlocks << " blocks of " << blockSize << " frames\n";
+    for (const auto& benchmarkCase: generateCases(directory))
+    {
+        const auto instrument = directory.getChildFile("instrument.sfz");
+        instrument.replaceWithText("<region> lokey=21 hikey=108 pitch_keycenter=60 " + benchmarkCase.region + "\n");
+
+        SfzSynth synth;
+        synth.setRandomSeed(1);
+        if (!synth.loadSfzFile(instrument.getFullPathName().toStdString()))
+        {
+            std::cerr << "Could not load the instrument for " << benchmarkCase.name << '\n';
+            continue;
+        }
+        synth.prepareToPlay(config::defaultSampleRate, blockSize);
+        for (int note = 0; note < chordSize; ++note)
+            synth.registerNoteOn(1, 48 + note, 100, 0);
+
+        // Give the I/O threads the time to fill the streaming buffers
+        Thread::sleep(100);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            output.clear();
+            synth.renderNextBlock(output, 0, blockSize);
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const auto duration = std::chrono::duration<double, std::nano>(end - start).count();
+        const auto voiceFrames = static_cast<double>(chordSize) * numBlocks * blockSize;
+        std::cout << std::left << std::setw(24) << benchmarkCase.name
+                  << " " << std::fixed << std::setprecision(2) << duration / voiceFrames << " ns per voice frame, "
+                  << synth.getNumActiveVoices() << " voices left, "
+                  << synth.getNumUnderruns() << " underruns\n";
+    }
+    return 0;
+}